@@ -0,0 +1,331 @@
+#ifdef __linux__
+#define _GNU_SOURCE // strndup
+#endif
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "buffer.h"
+#include "lexer.h"
+#include "arena.h"
+#include "parser.h"
+#include "dirs.h"
+
+#define BENCH_MIN_NS 200000000ULL
+#define DEFAULT_OUTPUT_PATH "bench_output.txt"
+
+// Allocations are counted by linking with '--wrap`, which only the GNU style
+// linkers support, so elsewhere they're reported as zero
+static size_t num_allocs = 0;
+static size_t num_alloc_bytes = 0;
+
+#ifdef __linux__
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *pointer, size_t size);
+char *__real_strdup(const char *string);
+char *__real_strndup(const char *string, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+	++num_allocs;
+	num_alloc_bytes += size;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+	++num_allocs;
+	num_alloc_bytes += count * size;
+	return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *pointer, size_t size)
+{
+	++num_allocs;
+	num_alloc_bytes += size;
+	return __real_realloc(pointer, size);
+}
+
+char *__wrap_strdup(const char *string)
+{
+	++num_allocs;
+	num_alloc_bytes += strlen(string) + 1;
+	return __real_strdup(string);
+}
+
+char *__wrap_strndup(const char *string, size_t size)
+{
+	++num_allocs;
+	num_alloc_bytes += strnlen(string, size) + 1;
+	return __real_strndup(string, size);
+}
+#endif
+
+static unsigned long long get_time_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (unsigned long long) now.tv_sec * 1000000000ULL + (unsigned long long) now.tv_nsec;
+}
+
+// Runs one batch of a benchmark, returning how many operations it did
+typedef size_t (*Bench_Func)(void);
+
+// Results are written one per line in the same format as Go's benchmarks,
+// so the usual tools can compare two runs
+static void run_bench(FILE *output, char *name, Bench_Func func)
+{
+	func(); // Warm up
+
+	num_allocs = num_alloc_bytes = 0;
+	size_t ops = 0;
+	unsigned long long start = get_time_ns(), elapsed;
+	do {
+		ops += func();
+		elapsed = get_time_ns() - start;
+	} while (elapsed < BENCH_MIN_NS);
+
+	double ns_per_op = (double) elapsed / ops;
+	double allocs_per_op = (double) num_allocs / ops;
+	double bytes_per_op = (double) num_alloc_bytes / ops;
+	fprintf(output, "Benchmark/%s\t%zu\t%.1f ns/op\t%.0f B/op\t%.2f allocs/op\n", name, ops, ns_per_op, bytes_per_op, allocs_per_op);
+	fprintf(stderr, "%-24s %12.1f ns/op %10.0f B/op %8.2f allocs/op\n", name, ns_per_op, bytes_per_op, allocs_per_op);
+}
+
+typedef struct {
+	char *lines[16];
+	size_t count;
+} Corpus;
+
+static Corpus short_lines = {
+	.lines = {
+		"ls -la",
+		"cd ..",
+		"git status",
+		"grep -rn TODO src | sort | uniq -c > todo.txt",
+		"echo \"hello $USER\" 'single quoted'",
+		"make -j8 && ./bin/hush",
+		"cat file.txt | head -n 20; echo done",
+		"export PATH=$HOME/bin:$PATH",
+	},
+	.count = 8,
+};
+
+static char args_line[BUFF_CAP + 1];
+static Corpus args_lines = {
+	.lines = {args_line},
+	.count = 1,
+};
+
+static Corpus redirect_lines = {
+	.lines = {
+		"cmd < in.txt > out.txt 2> err.txt",
+		"cmd >> log.txt 2>&1 3<> rw.txt 4< in.txt",
+		"sort < unsorted.txt > sorted.txt 2>> errors.txt; wc -l < sorted.txt >> counts.txt",
+		"a > 1 | b 2> 2 | c >> 3 | d < 4",
+	},
+	.count = 4,
+};
+
+// One argument list of nearly a full buffer
+static void init_args_line(void)
+{
+	size_t len = 0;
+	memcpy(args_line, "command", 7);
+	len += 7;
+	for (size_t i = 0; len + 16 < BUFF_CAP; ++i) {
+		len += (size_t) snprintf(args_line + len, BUFF_CAP - len, " argument%zu", i);
+	}
+	args_line[len] = '\0';
+}
+
+static Buffer buffer;
+
+// The lexer writes into the buffer, so every pass starts from a fresh copy
+static void load_buffer(char *line)
+{
+	set_buffer(&buffer, line, strlen(line));
+}
+
+static size_t lex_corpus(Corpus *corpus)
+{
+	for (size_t i = 0; i < corpus->count; ++i) {
+		load_buffer(corpus->lines[i]);
+		while (get_next_lexeme(&buffer).type != HUSH_LEXEME_TYPE_END_OF_BUFFER);
+	}
+	return corpus->count;
+}
+
+static size_t parse_corpus(Corpus *corpus)
+{
+	for (size_t i = 0; i < corpus->count; ++i) {
+		load_buffer(corpus->lines[i]);
+		bool is_failed;
+		for (Command command = get_next_command(&buffer, &is_failed); command.name != NULL; command = get_next_command(&buffer, &is_failed)) {
+			free(command.args);
+			free(command.redirects);
+		}
+	}
+	return corpus->count;
+}
+
+static size_t bench_lex_short(void) { return lex_corpus(&short_lines); }
+static size_t bench_lex_args(void) { return lex_corpus(&args_lines); }
+static size_t bench_lex_redirects(void) { return lex_corpus(&redirect_lines); }
+static size_t bench_parse_short(void) { return parse_corpus(&short_lines); }
+static size_t bench_parse_args(void) { return parse_corpus(&args_lines); }
+static size_t bench_parse_redirects(void) { return parse_corpus(&redirect_lines); }
+
+// The editor reads a key at a time from standard input, which is replaced by
+// a socket that keeps each key written to it a separate read
+static int keys_fd = -1;
+
+static void send_key(char *key, size_t len)
+{
+	write(keys_fd, key, len);
+}
+
+static void send_text(char *text)
+{
+	for (; *text != '\0'; ++text) {
+		send_key(text, 1);
+	}
+}
+
+// Operations for the editor are keystrokes
+static size_t bench_edit_type(void)
+{
+	char *line = "grep -rn TODO src | sort | uniq -c > todo.txt";
+	send_text(line);
+	send_key("\n", 1);
+	get_next_buffer();
+	return strlen(line) + 1;
+}
+
+static size_t bench_edit_insert_middle(void)
+{
+	char *line = "echo the quick brown fox jumps over the lazy dog";
+	send_text(line);
+	for (size_t i = 0; i < 20; ++i) {
+		send_key("\033[D", 3);
+	}
+	send_text("very ");
+	for (size_t i = 0; i < 10; ++i) {
+		send_key("\177", 1);
+	}
+	send_key("\n", 1);
+	get_next_buffer();
+	return strlen(line) + 20 + 5 + 10 + 1;
+}
+
+static size_t bench_edit_history(void)
+{
+	size_t num_keys = 0;
+	for (size_t i = 0; i < 100; ++i, ++num_keys) {
+		send_key("\033[A", 3);
+	}
+	for (size_t i = 0; i < 100; ++i, ++num_keys) {
+		send_key("\033[B", 3);
+	}
+	send_key("\033", 1);
+	send_key("\n", 1);
+	get_next_buffer();
+	return num_keys + 2;
+}
+
+// Directories are looked up in a database of tens of thousands, each visited
+// once, which is read in before the first lookup is timed. Thousands of them
+// have every run of three bytes in the patterns.
+#define BENCH_NUM_DIRS 50000
+
+static char db_path[] = "/tmp/hush_bench_dirs_XXXXXX";
+static char *jump_patterns[] = {"team1", "src", NULL};
+
+static size_t bench_jump(void)
+{
+	find_frecent_dir(jump_patterns);
+	return 1;
+}
+
+static bool init_jump(void)
+{
+	int fd = mkstemp(db_path);
+	FILE *db_file = (fd == -1) ? NULL : fdopen(fd, "w");
+	if (db_file == NULL) {
+		fprintf(stderr, "bench: unable to create directory database, skipping jumps\n");
+		return false;
+	}
+	long now = (long) time(NULL);
+	for (size_t i = 0; i < BENCH_NUM_DIRS; ++i) {
+		fprintf(db_file, "1 %ld /home/user/monorepo/team%zu/project%zu/%s/module%zu\n", now - (long) i, i % 97, i % 1009, (i % 7 == 0) ? "src" : "docs", i);
+	}
+	fclose(db_file);
+	init_dirs(db_path);
+	return find_frecent_dir(jump_patterns) != NULL;
+}
+
+static bool init_editor(void)
+{
+	int keys[2];
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, keys) == -1) {
+		fprintf(stderr, "bench: unable to create key socket, skipping the editor\n");
+		return false;
+	}
+	dup2(keys[0], STDIN_FILENO);
+	close(keys[0]);
+	keys_fd = keys[1];
+
+	// Nothing the editor echoes is of interest
+	int null_fd = open("/dev/null", O_WRONLY);
+	dup2(null_fd, STDOUT_FILENO);
+	close(null_fd);
+
+	// The history is never released, so nothing is written back to the
+	// history file. Filling it means every run walks the same full history.
+	init_history();
+	char line[64];
+	for (size_t i = 0; i < HIST_CAP; ++i) {
+		snprintf(line, sizeof (line), "echo history entry %zu", i);
+		send_text(line);
+		send_key("\n", 1);
+		get_next_buffer();
+	}
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	char *output_path = (argc > 1) ? argv[1] : DEFAULT_OUTPUT_PATH;
+	FILE *output = fopen(output_path, "w");
+	if (output == NULL) {
+		fprintf(stderr, "bench: unable to open '%s`\n", output_path);
+		return 1;
+	}
+	init_args_line();
+
+	run_bench(output, "lex/short", bench_lex_short);
+	run_bench(output, "lex/args-4k", bench_lex_args);
+	run_bench(output, "lex/redirects", bench_lex_redirects);
+	run_bench(output, "parse/short", bench_parse_short);
+	run_bench(output, "parse/args-4k", bench_parse_args);
+	run_bench(output, "parse/redirects", bench_parse_redirects);
+	if (init_jump()) {
+		run_bench(output, "jump/50k-dirs", bench_jump);
+	}
+	unlink(db_path);
+	if (init_editor()) {
+		run_bench(output, "edit/type", bench_edit_type);
+		run_bench(output, "edit/insert-middle", bench_edit_insert_middle);
+		run_bench(output, "edit/history-1000", bench_edit_history);
+	}
+
+	fclose(output);
+	return 0;
+}
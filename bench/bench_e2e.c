@@ -0,0 +1,264 @@
+#ifdef __linux__
+#define _GNU_SOURCE // posix_openpt
+#endif
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_OUTPUT_PATH "bench_e2e_output.txt"
+
+// Both shells are given the same prompt so the end of each command can be
+// recognized the same way
+#define PROMPT "hush % "
+
+#define PTY_WARMUP 20
+#define PTY_SAMPLES 300
+#define SCRIPT_LINES 200
+#define SCRIPT_SAMPLES 30
+#define TIMEOUT_MS 5000
+
+typedef struct {
+	char *name;
+	char *line;
+} Workload;
+
+static Workload workloads[] = {
+	{"true", "true"},
+	{"pipeline", "echo hello | cat"},
+	{"redirects", "echo x > out.txt; cat < out.txt >> log.txt 2> /dev/null"},
+	{"builtin-loop", "for i in 1 2 3 4 5 6 7 8 9 10; do x=$i; echo $x > /dev/null; done"},
+};
+
+static unsigned long long get_time_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (unsigned long long) now.tv_sec * 1000000000ULL + (unsigned long long) now.tv_nsec;
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *) a, y = *(const unsigned long long *) b;
+	return (x > y) - (x < y);
+}
+
+// Samples are the nanoseconds each command took, results are written in the
+// same format as Go's benchmarks
+static void report(FILE *output, char *name, unsigned long long *samples, size_t count, unsigned long long total_ns, size_t num_commands)
+{
+	qsort(samples, count, sizeof (unsigned long long), compare_samples);
+	double ns_per_op = (double) total_ns / num_commands;
+	double p50 = (double) samples[count * 50 / 100];
+	double p99 = (double) samples[(count * 99 / 100 < count) ? count * 99 / 100 : count - 1];
+	double per_second = 1e9 / ns_per_op;
+	fprintf(output, "Benchmark/%s\t%zu\t%.0f ns/op\t%.0f p50-ns/op\t%.0f p99-ns/op\t%.0f cmds/s\n", name, num_commands, ns_per_op, p50, p99, per_second);
+	printf("%-36s %10.0f cmds/s   p50 %9.1f us   p99 %9.1f us\n", name, per_second, p50 / 1000, p99 / 1000);
+}
+
+// Starts the shell with a pseudo-terminal as its controlling terminal
+static pid_t spawn_on_pty(char *shell, int *master_fd)
+{
+	int master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master == -1 || grantpt(master) == -1 || unlockpt(master) == -1) {
+		fprintf(stderr, "bench-e2e: unable to open a pseudo-terminal\n");
+		return -1;
+	}
+	char *slave_name = ptsname(master);
+	pid_t pid = fork();
+	if (pid == 0) {
+		setsid();
+		int slave = open(slave_name, O_RDWR);
+		if (slave == -1) {
+			_exit(127);
+		}
+		dup2(slave, STDIN_FILENO);
+		dup2(slave, STDOUT_FILENO);
+		dup2(slave, STDERR_FILENO);
+		close(slave);
+		close(master);
+		setenv("PS1", PROMPT, 1);
+		execl(shell, shell, (char *) NULL);
+		_exit(127);
+	}
+	*master_fd = master;
+	return pid;
+}
+
+// Reads everything the shell writes until it shows the prompt again
+static bool wait_for_prompt(int master)
+{
+	size_t matched = 0, prompt_len = strlen(PROMPT);
+	char output[4096];
+	while (true) {
+		struct pollfd master_poll = {.fd = master, .events = POLLIN};
+		if (poll(&master_poll, 1, TIMEOUT_MS) <= 0) {
+			return false;
+		}
+		ssize_t count = read(master, output, sizeof (output));
+		if (count <= 0) {
+			return false;
+		}
+		for (ssize_t i = 0; i < count; ++i) {
+			if (output[i] == PROMPT[matched]) {
+				++matched;
+			} else {
+				matched = (output[i] == PROMPT[0]) ? 1 : 0;
+			}
+			if (matched == prompt_len) {
+
+				// Anything after the prompt would be a second one
+				if (i + 1 == count) {
+					return true;
+				}
+				matched = 0;
+			}
+		}
+	}
+}
+
+// Types each command into an interactive shell and times how long it takes
+// for the prompt to come back
+static bool bench_pty(FILE *output, char *shell, char *shell_name, Workload workload)
+{
+	int master;
+	pid_t pid = spawn_on_pty(shell, &master);
+	if (pid == -1) {
+		return false;
+	}
+	bool is_done = false;
+	unsigned long long *samples = (unsigned long long *) malloc(PTY_SAMPLES * sizeof (unsigned long long));
+	char line[256];
+	size_t line_len = (size_t) snprintf(line, sizeof (line), "%s\n", workload.line);
+	if (wait_for_prompt(master)) {
+		unsigned long long total_ns = 0;
+		size_t i;
+		for (i = 0; i < PTY_WARMUP + PTY_SAMPLES; ++i) {
+			unsigned long long start = get_time_ns();
+			if (write(master, line, line_len) != (ssize_t) line_len || !wait_for_prompt(master)) {
+				break;
+			}
+			if (i >= PTY_WARMUP) {
+				samples[i - PTY_WARMUP] = get_time_ns() - start;
+				total_ns += samples[i - PTY_WARMUP];
+			}
+		}
+		if (i == PTY_WARMUP + PTY_SAMPLES) {
+			char name[128];
+			snprintf(name, sizeof (name), "e2e/pty/%s/%s", workload.name, shell_name);
+			report(output, name, samples, PTY_SAMPLES, total_ns, PTY_SAMPLES);
+			is_done = true;
+		}
+	}
+	if (!is_done) {
+		fprintf(stderr, "bench-e2e: %s stopped responding on '%s`\n", shell_name, workload.line);
+	}
+
+	// Killed rather than asked to exit so nothing gets saved to its history
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+	close(master);
+	free(samples);
+	return is_done;
+}
+
+// Runs a script of the same command over and over, each run being one sample
+static bool bench_script(FILE *output, char *shell, char *shell_name, Workload workload)
+{
+	char *script_path = "script.sh";
+	FILE *script = fopen(script_path, "w");
+	if (script == NULL) {
+		fprintf(stderr, "bench-e2e: unable to write '%s`\n", script_path);
+		return false;
+	}
+	for (size_t i = 0; i < SCRIPT_LINES; ++i) {
+		fprintf(script, "%s\n", workload.line);
+	}
+	fclose(script);
+
+	unsigned long long samples[SCRIPT_SAMPLES], total_ns = 0;
+	for (size_t i = 0; i < SCRIPT_SAMPLES + 1; ++i) {
+		unsigned long long start = get_time_ns();
+		pid_t pid = fork();
+		if (pid == 0) {
+			int null_fd = open("/dev/null", O_RDWR);
+			dup2(null_fd, STDIN_FILENO);
+			dup2(null_fd, STDOUT_FILENO);
+			close(null_fd);
+			execl(shell, shell, script_path, (char *) NULL);
+			_exit(127);
+		}
+		int status = 0;
+		if (pid == -1 || waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			fprintf(stderr, "bench-e2e: %s failed running '%s`\n", shell_name, workload.line);
+			return false;
+		}
+
+		// The first run only warms up the caches
+		if (i > 0) {
+			samples[i - 1] = (get_time_ns() - start) / SCRIPT_LINES;
+			total_ns += samples[i - 1] * SCRIPT_LINES;
+		}
+	}
+	char name[128];
+	snprintf(name, sizeof (name), "e2e/script/%s/%s", workload.name, shell_name);
+	report(output, name, samples, SCRIPT_SAMPLES, total_ns, SCRIPT_SAMPLES * SCRIPT_LINES);
+	return true;
+}
+
+// usage: bench-e2e HUSH [BASELINE_SHELL [OUTPUT]]
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s HUSH [BASELINE_SHELL [OUTPUT]]\n", argv[0]);
+		return 1;
+	}
+	char *shells[2], *shell_names[2] = {"hush", "baseline"};
+	shells[0] = realpath(argv[1], NULL);
+	shells[1] = (argc > 2) ? argv[2] : "/bin/sh";
+	char *output_path = (argc > 3) ? argv[3] : DEFAULT_OUTPUT_PATH;
+	if (shells[0] == NULL) {
+		fprintf(stderr, "bench-e2e: unable to find '%s`\n", argv[1]);
+		return 1;
+	}
+	FILE *output = fopen(output_path, "w");
+	if (output == NULL) {
+		fprintf(stderr, "bench-e2e: unable to open '%s`\n", output_path);
+		return 1;
+	}
+
+	// Commands run in a scratch directory so their files don't end up anywhere else
+	char work_dir[] = "/tmp/hush_bench_XXXXXX";
+	if (mkdtemp(work_dir) == NULL || chdir(work_dir) == -1) {
+		fprintf(stderr, "bench-e2e: unable to create a scratch directory\n");
+		return 1;
+	}
+
+	int status = 0;
+	for (size_t i = 0; i < sizeof (workloads) / sizeof (Workload); ++i) {
+		for (size_t j = 0; j < 2; ++j) {
+			if (!bench_pty(output, shells[j], shell_names[j], workloads[i])) {
+				status = 1;
+			}
+			if (!bench_script(output, shells[j], shell_names[j], workloads[i])) {
+				status = 1;
+			}
+		}
+	}
+	fclose(output);
+
+	unlink("script.sh");
+	unlink("out.txt");
+	unlink("log.txt");
+	if (chdir("/") == 0) {
+		rmdir(work_dir);
+	}
+	return status;
+}
@@ -2,47 +2,359 @@
 #include "cbs.h"
 
 #define CC "cc"
-#define CFLAGS "-Wall", "-Wextra", "-Wpedantic", "-I./src", "-c"
+#define CFLAGS "-Wall", "-Wextra", "-Wpedantic", "-I./src", "-MMD", "-c"
+#define LDFLAGS "-pthread"
 #define TARGET_NAME "hush"
+#define BENCH_NAME "bench"
+#define BENCH_OUTPUT "bench_output.txt"
+#define BENCH_E2E_NAME "bench-e2e"
+#define BENCH_E2E_OUTPUT "bench_e2e_output.txt"
+#define BENCH_E2E_BASELINE "/bin/sh"
+
+// Counts the allocations made while benchmarking
+#define BENCH_WRAP_FLAGS "-Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=strdup,--wrap=strndup"
+
+// Profile guided builds are trained on both benchmarks, which run the shell
+// in another directory, so where the profiles go has to be absolute
+#define PGO_DATA_DIR "/obj/pgo-data"
+#ifdef __APPLE__
+#define PROFDATA "xcrun llvm-profdata"
+#else
+#define PROFDATA "llvm-profdata"
+#endif
 
 #define FOR_OPTIONS(DO) \
-	DO(build) \
-	DO(run) \
-	DO(clean) \
+	DO(build, "build") \
+	DO(run, "run") \
+	DO(clean, "clean") \
+	DO(bench, "bench") \
+	DO(bench_e2e, "bench-e2e") \
+	DO(release, "release") \
+	DO(pgo, "pgo") \
+
+// Each profile keeps its own objects so switching between them never links
+// objects built with different flags, its flags are used to compile and link
+typedef struct {
+	const char *obj_dir;
+	const char *bin_dir;
+	const char *flags[4];
+} Profile;
+
+static Profile debug_profile = {"./obj", "./bin", {NULL}};
+static Profile release_profile = {"./obj/release", "./bin/release", {"-O2", "-flto", NULL}};
+
+// Both stages of a profile guided build share their objects, gcc names its
+// profiles after the object files they came from. Where the profiles go is
+// only known once cbs is running.
+static Profile pgo_generate_profile = {"./obj/pgo", "./bin/pgo", {"-O2", NULL}};
+static Profile pgo_use_profile = {"./obj/pgo", "./bin/pgo", {"-O2", "-flto", NULL}};
+
+static void cmd_build_profile(Cbs_Cmd *cmd, Profile *profile) {
+	for (size_t i = 0; i < sizeof(profile->flags) / sizeof(profile->flags[0]) && profile->flags[i] != NULL; ++i)
+		cbs_cmd_append(cmd, profile->flags[i]);
+}
+
+// Every object records the headers it includes in the '.d` file -MMD writes
+// next to it, and in a '.hash` file a hash of how it was compiled followed by
+// one of that and all those files. The first is checked every time, the
+// second only when something is newer than it, so files that were touched
+// but didn't change don't cause a rebuild.
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+typedef struct {
+	const char *obj_path;
+	unsigned long long cmd_hash;
+	unsigned long long hash;
+} Compiled;
+
+// Compiles as many objects at once as there are cores
+typedef struct {
+	Cbs_Async_Procs procs;
+	Compiled *compiled;
+	size_t num_jobs;
+} Batch;
+
+// Modification times only count seconds, too coarse to tell whether what was
+// linked in the same second is out of date
+static bool has_compiled = false;
+
+static const char *swap_ext(const char *obj_path, const char *ext) {
+	return cbs_string_build(cbs_strip_file_ext(obj_path), ext);
+}
+
+static unsigned long long hash_bytes(unsigned long long hash, const char *bytes, size_t len) {
+	for (size_t i = 0; i < len; ++i) {
+		hash ^= (unsigned char) bytes[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+static unsigned long long hash_cmd(Cbs_Cmd *cmd) {
+	unsigned long long hash = FNV_OFFSET;
+	for (size_t i = 0; i < cmd->count; ++i)
+		hash = hash_bytes(hash, cmd->items[i], strlen(cmd->items[i]) + 1);
+	return hash;
+}
+
+// Paths in the dependency file come after the object's name, spaces in them
+// are escaped and long lists are continued with a backslash
+static bool read_deps(const char *dep_path, Cbs_File_Paths *deps) {
+	FILE *dep_file = fopen(dep_path, "r");
+	if (dep_file == NULL) return false;
+	char path[4096];
+	size_t path_len = 0;
+	bool is_target = true;
+	int c;
+	while ((c = fgetc(dep_file)) != EOF) {
+		if (c == '\\') {
+			c = fgetc(dep_file);
+			if (c == '\n' || c == EOF) continue;
+			if (c != ' ' && path_len < sizeof(path) - 1) path[path_len++] = '\\';
+		} else if (c == ':' && is_target) {
+			is_target = false;
+			path_len = 0;
+			continue;
+		} else if (c == ' ' || c == '\t' || c == '\n') {
+			if (path_len > 0 && !is_target) cbs_file_paths_append(deps, strndup(path, path_len));
+			path_len = 0;
+			continue;
+		}
+		if (path_len < sizeof(path) - 1) path[path_len++] = (char) c;
+	}
+	if (path_len > 0 && !is_target) cbs_file_paths_append(deps, strndup(path, path_len));
+	fclose(dep_file);
+	return !is_target;
+}
+
+// Finishes a command's hash with the contents of everything the object was
+// built from, failing if any of it is gone
+static bool hash_deps(const char *obj_path, unsigned long long *hash) {
+	Cbs_File_Paths deps = {0};
+	bool is_hashed = read_deps(swap_ext(obj_path, ".d"), &deps);
+	char bytes[8192];
+	for (size_t i = 0; is_hashed && i < deps.count; ++i) {
+		FILE *dep = fopen(deps.items[i], "rb");
+		if (dep == NULL) {
+			is_hashed = false;
+			break;
+		}
+		size_t len;
+		while ((len = fread(bytes, 1, sizeof(bytes), dep)) > 0) *hash = hash_bytes(*hash, bytes, len);
+		fclose(dep);
+	}
+	if (deps.count > 0) cbs_file_paths_free(&deps);
+	return is_hashed;
+}
+
+static bool write_hash(const char *obj_path, unsigned long long cmd_hash, unsigned long long hash) {
+	FILE *hash_file = fopen(swap_ext(obj_path, ".hash"), "w");
+	if (hash_file == NULL) return false;
+	fprintf(hash_file, "%016llx %016llx\n", cmd_hash, hash);
+	fclose(hash_file);
+	return true;
+}
+
+static bool is_up_to_date(const char *obj_path, Cbs_Cmd *cmd) {
+	const char *hash_path = swap_ext(obj_path, ".hash");
+	if (!cbs_files_exist(obj_path, hash_path)) return false;
+
+	// Flags can change without any file changing
+	unsigned long long cmd_hash = hash_cmd(cmd), stored_cmd_hash = 0, stored_hash = 0;
+	FILE *hash_file = fopen(hash_path, "r");
+	if (hash_file == NULL) return false;
+	bool has_stored_hash = fscanf(hash_file, "%llx %llx", &stored_cmd_hash, &stored_hash) == 2;
+	fclose(hash_file);
+	if (!has_stored_hash || cmd_hash != stored_cmd_hash) return false;
+
+	Cbs_File_Paths deps = {0};
+	if (!read_deps(swap_ext(obj_path, ".d"), &deps)) return false;
+
+	// Modification times only count seconds, so anything changed in the
+	// same second as the hash was written is hashed again to be sure
+	struct stat hash_stat, dep_stat;
+	bool is_touched = stat(hash_path, &hash_stat) == -1;
+	for (size_t i = 0; i < deps.count && !is_touched; ++i)
+		is_touched = stat(deps.items[i], &dep_stat) == -1 || dep_stat.st_mtime >= hash_stat.st_mtime;
+	if (deps.count > 0) cbs_file_paths_free(&deps);
+	if (!is_touched) return true;
+
+	unsigned long long hash = cmd_hash;
+	if (!hash_deps(obj_path, &hash) || hash != stored_hash) return false;
+
+	// Rewritten so the same files aren't hashed again next time
+	return write_hash(obj_path, cmd_hash, hash);
+}
+
+static void batch_wait(Batch *batch) {
+	size_t num_compiled = batch->procs.count;
+	cbs_async_wait(&batch->procs);
+	for (size_t i = 0; i < num_compiled; ++i) {
+		Compiled compiled = batch->compiled[i];
+		if (!hash_deps(compiled.obj_path, &compiled.hash) || !write_hash(compiled.obj_path, compiled.cmd_hash, compiled.hash))
+			remove(swap_ext(compiled.obj_path, ".hash"));
+	}
+}
+
+static void batch_compile(Batch *batch, Profile *profile, const char *obj_path, const char *src_path, bool should_force) {
+	Cbs_Cmd cmd = {0};
+	cbs_cmd_build(&cmd, CC, CFLAGS);
+	cmd_build_profile(&cmd, profile);
+	cbs_cmd_build(&cmd, "-o", obj_path, src_path);
+	if (!should_force && is_up_to_date(obj_path, &cmd)) {
+		cbs_cmd_clear(&cmd);
+		return;
+	}
+	if (batch->num_jobs == 0) {
+		long num_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+		batch->num_jobs = (num_jobs < 1) ? 1 : (size_t) num_jobs;
+		batch->compiled = malloc(batch->num_jobs * sizeof(Compiled));
+		if (batch->compiled == NULL) cbs__malloc_error;
+	}
+	unsigned long long cmd_hash = hash_cmd(&cmd);
+	batch->compiled[batch->procs.count] = (Compiled) {obj_path, cmd_hash, cmd_hash};
+	has_compiled = true;
+	cbs_cmd_async_run(&batch->procs, &cmd);
+	if (batch->procs.count == batch->num_jobs) batch_wait(batch);
+}
+
+static const char *build_profile(Profile *profile, bool should_force) {
 
-void build(void) {
-	
 	// Compile source files
 	Cbs_File_Paths src_paths = {0}, obj_paths = {0};
+	Batch batch = {0};
 	cbs_file_paths_build_file_ext(&src_paths, "./src", ".c");
-	if (!cbs_file_exists("./obj")) cbs_run("mkdir", "./obj");
+	if (!cbs_file_exists(profile->obj_dir)) cbs_run("mkdir", "-p", profile->obj_dir);
 	cbs_file_paths_for_each(src_path, src_paths) {
 		const char *obj_name = cbs_strip_file_ext(cbs_get_file_name(src_path));
-		const char *obj_path = cbs_string_build("./obj/", obj_name, ".o");
+		const char *obj_path = cbs_string_build(profile->obj_dir, "/", obj_name, ".o");
 		cbs_file_paths_append(&obj_paths, obj_path);
-		if (cbs_needs_rebuild(obj_path, src_path))
-			cbs_run(CC, CFLAGS, "-o", obj_path, src_path);
+		batch_compile(&batch, profile, obj_path, src_path, should_force);
 	}
+	batch_wait(&batch);
+	free(batch.compiled);
 	cbs_file_paths_free(&src_paths);
 
 	// Link object files
-	if (!cbs_file_exists("./bin")) cbs_run("mkdir", "./bin");
-	const char *target_path = cbs_string_build("./bin/", TARGET_NAME);
-	if (cbs_needs_rebuild_file_paths(target_path, obj_paths)) {
+	if (!cbs_file_exists(profile->bin_dir)) cbs_run("mkdir", "-p", profile->bin_dir);
+	const char *target_path = cbs_string_build(profile->bin_dir, "/", TARGET_NAME);
+	if (should_force || has_compiled || cbs_needs_rebuild_file_paths(target_path, obj_paths)) {
 		Cbs_Cmd cmd = {0};
 		cbs_cmd_build(&cmd, CC, "-o", target_path);
 		cbs_cmd_build_file_paths(&cmd, obj_paths);
+		cbs_cmd_build(&cmd, LDFLAGS);
+		cmd_build_profile(&cmd, profile);
 		cbs_cmd_run(&cmd);
 	}
 	cbs_file_paths_free(&obj_paths);
+	return target_path;
 }
 
-void run(void) {
-	Cbs_File_Paths src_paths = {0};
+// Links the benchmarks against everything in a profile but main
+static const char *build_bench(Profile *profile) {
+	const char *bench_obj_path = cbs_string_build(profile->obj_dir, "/", BENCH_NAME, ".o");
+	Batch batch = {0};
+	batch_compile(&batch, profile, bench_obj_path, "./bench/bench.c", false);
+	batch_wait(&batch);
+	free(batch.compiled);
+
+	const char *bench_path = cbs_string_build(profile->bin_dir, "/", BENCH_NAME);
+	Cbs_File_Paths src_paths = {0}, obj_paths = {0};
 	cbs_file_paths_build_file_ext(&src_paths, "./src", ".c");
-	const char *target_path = cbs_string_build("./bin/", TARGET_NAME);
-	if (cbs_needs_rebuild_file_paths(target_path, src_paths)) build();
-	cbs_run(target_path);
+	cbs_file_paths_append(&obj_paths, bench_obj_path);
+	cbs_file_paths_for_each(src_path, src_paths) {
+		const char *obj_name = cbs_strip_file_ext(cbs_get_file_name(src_path));
+		if (!cbs_string_eq(obj_name, "main"))
+			cbs_file_paths_append(&obj_paths, cbs_string_build(profile->obj_dir, "/", obj_name, ".o"));
+	}
+	cbs_file_paths_free(&src_paths);
+	if (has_compiled || cbs_needs_rebuild_file_paths(bench_path, obj_paths)) {
+		Cbs_Cmd cmd = {0};
+		cbs_cmd_build(&cmd, CC, "-o", bench_path);
+		cbs_cmd_build_file_paths(&cmd, obj_paths);
+		cbs_cmd_build(&cmd, LDFLAGS);
+		cmd_build_profile(&cmd, profile);
+#ifdef __linux__
+		cbs_cmd_append(&cmd, BENCH_WRAP_FLAGS);
+#endif
+		cbs_cmd_run(&cmd);
+	}
+	cbs_file_paths_free(&obj_paths);
+	return bench_path;
+}
+
+// Drives the shell from outside, so it doesn't link against it
+static const char *build_bench_e2e(void) {
+	if (!cbs_file_exists("./bin")) cbs_run("mkdir", "./bin");
+	const char *bench_path = cbs_string_build("./bin/", BENCH_E2E_NAME);
+	if (cbs_needs_rebuild(bench_path, "./bench/bench_e2e.c"))
+		cbs_run(CC, "-Wall", "-Wextra", "-Wpedantic", "-o", bench_path, "./bench/bench_e2e.c");
+	return bench_path;
+}
+
+void build(void) {
+	build_profile(&debug_profile, false);
+}
+
+// Building is incremental, so headers are checked along with the sources
+void run(void) {
+	cbs_run(build_profile(&debug_profile, false));
+}
+
+void bench(void) {
+	build();
+	cbs_run(build_bench(&debug_profile), BENCH_OUTPUT);
+}
+
+void bench_e2e(void) {
+	build();
+	cbs_run(build_bench_e2e(), "./bin/" TARGET_NAME, BENCH_E2E_BASELINE, BENCH_E2E_OUTPUT);
+}
+
+void release(void) {
+	build_profile(&release_profile, false);
+}
+
+// Asks the compiler that builds the shell rather than the one that built cbs,
+// since the two can differ and each wants its profiles handled its own way
+static bool is_cc_clang(void) {
+	FILE *version = popen(CC " --version 2>/dev/null", "r");
+	if (version == NULL) cbs_error("Unable to run " CC);
+	bool is_clang = false;
+	char line[256];
+	while (fgets(line, sizeof(line), version) != NULL)
+		if (strstr(line, "clang") != NULL) is_clang = true;
+	pclose(version);
+	return is_clang;
+}
+
+// Builds an instrumented shell, trains it on the benchmarks and then builds
+// it again with what was learned. Only shells that exit on their own write
+// out a profile, so the scripts and the editor benchmarks are what count.
+void pgo(void) {
+	char cwd[4096];
+	if (getcwd(cwd, sizeof(cwd)) == NULL) cbs_error("Unable to get the current directory");
+	const char *data_dir = cbs_string_build(cwd, PGO_DATA_DIR);
+	cbs_run("rm", "-rf", data_dir);
+	pgo_generate_profile.flags[1] = cbs_string_build("-fprofile-generate=", data_dir);
+	const char *target_path = build_profile(&pgo_generate_profile, true);
+	cbs_run(build_bench(&pgo_generate_profile), "/dev/null");
+
+	// Trained in place of the baseline shell as well, which has to be absolute
+	const char *baseline_path = cbs_string_build(cwd, "/", target_path);
+	cbs_run(build_bench_e2e(), target_path, baseline_path, "/dev/null");
+
+	// Clang leaves raw profiles that have to be merged first
+	if (is_cc_clang()) {
+		const char *profile_path = cbs_string_build(data_dir, "/hush.profdata");
+		cbs_run("sh", "-c", cbs_string_build(PROFDATA " merge -output=", profile_path, " ", data_dir, "/*.profraw"));
+		pgo_use_profile.flags[2] = cbs_string_build("-fprofile-use=", profile_path);
+	} else {
+		pgo_use_profile.flags[2] = cbs_string_build("-fprofile-use=", data_dir);
+		pgo_use_profile.flags[3] = "-Wno-missing-profile";
+	}
+	build_profile(&pgo_use_profile, true);
 }
 
 void clean(void) {
@@ -55,7 +367,7 @@ int main(int argc, char **argv) {
 
 	const char *opt;
 	while ((opt = cbs_shift_args(&argc, &argv))) {
-#define CHECK_OPTION(name) if (cbs_string_eq(opt, #name)) { name(); continue; }
+#define CHECK_OPTION(func, name) if (cbs_string_eq(opt, name)) { func(); continue; }
 		FOR_OPTIONS(CHECK_OPTION)
 	}
 	
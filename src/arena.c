@@ -0,0 +1,63 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_BLOCK_CAP 8192
+#define ARENA_ALIGN (sizeof (max_align_t))
+
+void *arena_alloc(Arena *arena, size_t size)
+{
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	Arena_Block *head = arena->head;
+	if (head == NULL || head->used + size > head->cap) {
+		size_t cap = (head == NULL) ? ARENA_BLOCK_CAP : 2 * head->cap;
+		while (cap < size) {
+			cap *= 2;
+		}
+		Arena_Block *block = (Arena_Block *) malloc(sizeof (Arena_Block) + cap);
+		if (block == NULL) {
+			fprintf(stderr, "hush: unable to allocate memory\n");
+			exit(EXIT_FAILURE);
+		}
+		block->next = head;
+		block->used = 0;
+		block->cap = cap;
+		arena->head = head = block;
+	}
+	void *result = head->data + head->used;
+	head->used += size;
+	return result;
+}
+
+char *arena_strdup(Arena *arena, char *string)
+{
+	size_t len = strlen(string);
+	char *result = (char *) arena_alloc(arena, len + 1);
+	memcpy(result, string, len + 1);
+	return result;
+}
+
+void arena_reset(Arena *arena)
+{
+	if (arena->head == NULL) {
+		return;
+	}
+	Arena_Block *block = arena->head->next;
+	while (block != NULL) {
+		Arena_Block *next = block->next;
+		free(block);
+		block = next;
+	}
+	arena->head->next = NULL;
+	arena->head->used = 0;
+}
+
+void arena_free(Arena *arena)
+{
+	arena_reset(arena);
+	free(arena->head);
+	arena->head = NULL;
+}
@@ -0,0 +1,23 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+typedef struct Arena_Block Arena_Block;
+struct Arena_Block {
+	Arena_Block *next;
+	size_t used;
+	size_t cap;
+	char data[];
+};
+
+// Bump allocator for things that all die together, e.g. everything parsed
+// from one script command. Resetting keeps the largest block around.
+typedef struct {
+	Arena_Block *head;
+} Arena;
+
+void *arena_alloc(Arena *arena, size_t size);
+char *arena_strdup(Arena *arena, char *string);
+void arena_reset(Arena *arena);
+void arena_free(Arena *arena);
+
+#endif // ARENA_H_
@@ -1,23 +1,48 @@
 #include <assert.h>
 #include <ctype.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pwd.h>
+#include <signal.h>
+#include <sys/ioctl.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "buffer.h"
+#include "highlight.h"
+#include "prompt.h"
+#include "suggest.h"
+#include "trace.h"
 
 #define KEY_CAP 5
 
-char * const hush_prompt = "hush % ";
-const size_t hush_prompt_len = strlen(hush_prompt);
-
 typedef struct termios Termios;
 static Termios original;
 
+// Lines wider than the terminal wrap onto more rows, so where the cursor goes
+// depends on how wide it is. It's looked up again whenever it's resized.
+static size_t terminal_width = 80;
+static volatile sig_atomic_t is_resized = false;
+
+static void note_resize(int signal_number)
+{
+	(void) signal_number;
+	is_resized = true;
+}
+
+static void read_terminal_width(void)
+{
+	struct winsize size;
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0) {
+		terminal_width = size.ws_col;
+	}
+}
+
 void init_terminal(void)
 {
 	tcgetattr(STDIN_FILENO, &original);
@@ -26,6 +51,11 @@ void init_terminal(void)
 	raw.c_iflag |= ICRNL;
 	raw.c_lflag &= ~(ICANON | ECHO);
 	tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+
+	struct sigaction action = {.sa_handler = note_resize, .sa_flags = SA_RESTART};
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGWINCH, &action, NULL);
+	read_terminal_width();
 }
 
 void release_terminal(void)
@@ -33,36 +63,119 @@ void release_terminal(void)
 	tcsetattr(STDIN_FILENO, TCSANOW, &original);
 }
 
-static void clear_buffer(Buffer *buff)
+static void *resize(void *pointer, size_t size)
+{
+	pointer = realloc(pointer, size);
+	if (pointer == NULL) {
+		fprintf(stderr, "hush: unable to allocate memory\n");
+		exit(EXIT_FAILURE);
+	}
+	return pointer;
+}
+
+void set_buffer(Buffer *buffer, char *text, size_t len)
 {
-	memset(buff->text, 0, BUFF_CAP + 1);
-	buff->cursor = buff->end = buff->text;
+	if (len + 1 > buffer->cap) {
+		buffer->cap = (buffer->cap == 0) ? BUFF_CAP + 1 : buffer->cap;
+		while (buffer->cap < len + 1) {
+			buffer->cap *= 2;
+		}
+		buffer->text = (char *) resize(buffer->text, buffer->cap * sizeof (char));
+	}
+	memcpy(buffer->text, text, len);
+	buffer->text[len] = '\0';
+	buffer->cursor = buffer->text;
+	buffer->end = buffer->text + len;
 }
 
+// When an entry was run and for how many seconds, zero if it never was
+typedef struct {
+	time_t start;
+	double duration;
+} History_Time;
+
+// Entries are only as long as they need to be, NULL until one is stored
 typedef struct {
 	char *path;
-	Buffer buffs[HIST_CAP + 1];
-	Buffer *zero;
-	Buffer *cap;
-	Buffer *start;
-	Buffer *current;
-	Buffer *end;
+	char *entries[HIST_CAP + 1];
+	History_Time times[HIST_CAP + 1];
+	unsigned long ids[HIST_CAP + 1]; // Zero until the entry's been indexed
+	unsigned long next_id;
+	char **zero;
+	char **cap;
+	char **start;
+	char **current;
+	char **end;
+	bool is_extended; // The file was saved with times, which are then kept
 } History;
 static History hist;
 
-void init_history(void)
+static void store_entry(char **entry, char *text, size_t len)
 {
-	// Initialize history buffer structs
-	hist.zero = &hist.buffs[0];
-	hist.cap = &hist.buffs[HIST_CAP];
+	*entry = (char *) resize(*entry, (len + 1) * sizeof (char));
+	memcpy(*entry, text, len);
+	(*entry)[len] = '\0';
+}
 
-	for (hist.current = hist.zero; hist.current <= hist.cap; ++hist.current) {
-		clear_buffer(hist.current);
+static char *get_entry(char **entry)
+{
+	return (*entry == NULL) ? "" : *entry;
+}
+
+static bool is_entry_empty(char **entry)
+{
+	return *entry == NULL || **entry == '\0';
+}
+
+static char **get_next_entry(char **entry)
+{
+	return (entry == hist.cap) ? hist.zero : entry + 1;
+}
+
+// Entries that have left the history stay in the index until it's rebuilt
+// from what's still there, which happens whenever it's doubled in size
+static size_t index_limit = 0;
+
+static void rebuild_index(void)
+{
+	clear_entry_index();
+	for (char **entry = hist.start; entry != hist.end; entry = get_next_entry(entry)) {
+		size_t slot = entry - hist.zero;
+		if (hist.ids[slot] != 0) {
+			index_entry(get_entry(entry), strlen(get_entry(entry)), hist.ids[slot], slot);
+		}
 	}
+	index_limit = 2 * get_index_size() + 65536;
+}
 
-	// Regenerate history filepath name
-	struct passwd *user_pw = getpwuid(getuid());
-	const char *home_dir = user_pw->pw_dir;
+static void add_to_index(char **entry)
+{
+	size_t slot = entry - hist.zero;
+	hist.ids[slot] = ++hist.next_id;
+	index_entry(*entry, strlen(*entry), hist.ids[slot], slot);
+	if (get_index_size() > index_limit) {
+		rebuild_index();
+	}
+}
+
+// The history file is read on its own thread so the prompt shows straight
+// away. Entries go into every slot but the first, which is the only one the
+// editor touches before the first key, when the loader is waited for.
+static pthread_t history_loader;
+static bool is_history_loading = false;
+static size_t first_loaded = HIST_CAP; // Slot below the oldest entry read
+
+static void read_history_file(char *home_dir)
+{
+	// Looking the user up can mean asking a directory service, so HOME is
+	// tried first
+	if (home_dir == NULL) {
+		struct passwd *user_pw = getpwuid(getuid());
+		home_dir = (user_pw == NULL) ? NULL : user_pw->pw_dir;
+	}
+	if (home_dir == NULL) {
+		return;
+	}
 	const char *hist_name = "/.hush_history";
 	size_t home_dir_len = strlen(home_dir);
 	size_t hist_name_len = strlen(hist_name);
@@ -70,83 +183,1005 @@ void init_history(void)
 	strncpy(hist.path, home_dir, home_dir_len);
 	strncat(hist.path, hist_name, hist_name_len);
 
-	FILE *hist_file = fopen(hist.path, "r");
+	FILE *hist_file = fopen(hist.path, "re");
 	if (hist_file == NULL) {
-		hist.start = hist.current = hist.end = hist.zero;
 		return;
 	}
-	fseek(hist_file, 0, SEEK_SET);
 
 	// Read history file into hist struct
+	char *file_line = NULL;
+	size_t file_line_cap = 0;
+	ssize_t file_line_len;
 	size_t i;
-	for (i = HIST_CAP; i > 0 && fgets(hist.buffs[i].text, BUFF_CAP + 1, hist_file) != NULL; --i) {
+	for (i = HIST_CAP; i > 0 && (file_line_len = getline(&file_line, &file_line_cap, hist_file)) != -1; --i) {
 
 		// Get rid of the newline char
-		size_t nl_loc = strnlen(hist.buffs[i].text, BUFF_CAP + 1) - 1;
-		hist.buffs[i].text[nl_loc] = '\0';
-		hist.buffs[i].cursor = hist.buffs[i].end = &hist.buffs[i].text[nl_loc];
+		size_t nl_loc = (size_t) file_line_len;
+		if (nl_loc > 0 && file_line[nl_loc - 1] == '\n') {
+			file_line[--nl_loc] = '\0';
+		}
+
+		store_entry(&hist.entries[i], file_line, nl_loc);
 	}
+	free(file_line);
 	fclose(hist_file);
+	first_loaded = i;
+
+	// Entries saved with their times look like ': start:duration;command`.
+	// Every line has one or none do, so a command that only looks like one
+	// is left alone unless the whole file was saved that way.
+	long start;
+	double duration;
+	int prefix_len;
+	hist.is_extended = first_loaded < HIST_CAP;
+	for (i = HIST_CAP; i > first_loaded && hist.is_extended; --i) {
+		prefix_len = 0;
+		hist.is_extended = sscanf(hist.entries[i], ": %ld:%lf;%n", &start, &duration, &prefix_len) == 2 && prefix_len > 0;
+	}
+	for (i = HIST_CAP; i > first_loaded && hist.is_extended; --i) {
+		sscanf(hist.entries[i], ": %ld:%lf;%n", &start, &duration, &prefix_len);
+		hist.times[i].start = (time_t) start;
+		hist.times[i].duration = duration;
+		memmove(hist.entries[i], hist.entries[i] + prefix_len, strlen(hist.entries[i] + prefix_len) + 1);
+	}
+}
 
-	hist.start = &hist.buffs[(i + 1) % (HIST_CAP + 1)];
-	hist.current = hist.end = hist.zero;
+static void *load_history(void *arg)
+{
+	unsigned long long profile_begin = profile_now();
+	read_history_file((char *) arg);
+	free(arg);
+	profile_phase("history file", profile_begin);
+	return NULL;
 }
 
-void release_history(void)
+static void index_history(void)
 {
-	if (hist.start == hist.end && hist.end->text == hist.end->end) {
+	hist.start = &hist.entries[(first_loaded + 1) % (HIST_CAP + 1)];
+	for (char **entry = hist.start; entry != hist.end; entry = get_next_entry(entry)) {
+		hist.ids[entry - hist.zero] = ++hist.next_id;
+	}
+	rebuild_index();
+}
+
+static void finish_loading_history(void)
+{
+	if (!is_history_loading) {
 		return;
 	}
+	unsigned long long profile_begin = profile_now();
+	pthread_join(history_loader, NULL);
+	profile_phase("history wait", profile_begin);
+	is_history_loading = false;
+	index_history();
+}
+
+void init_history(void)
+{
+	hist.zero = &hist.entries[0];
+	hist.cap = &hist.entries[HIST_CAP];
+	hist.start = hist.current = hist.end = hist.zero;
+
+	char *home_dir = getenv("HOME");
+	home_dir = (home_dir == NULL || *home_dir == '\0') ? NULL : strdup(home_dir);
+	is_history_loading = true;
+	if (pthread_create(&history_loader, NULL, load_history, home_dir) != 0) {
+		is_history_loading = false;
+		load_history(home_dir);
+		index_history();
+	}
+}
 
-	FILE *hist_file = fopen(hist.path, "w");
+static void write_history_entry(FILE *hist_file, char **entry, bool should_save_times)
+{
+	History_Time *entry_time = &hist.times[entry - hist.zero];
+	if (should_save_times) {
+		fprintf(hist_file, ": %ld:%.3f;", (long) entry_time->start, entry_time->duration);
+	}
+	fprintf(hist_file, "%s\n", get_entry(entry));
+}
+
+void release_history(bool should_save_times)
+{
+	finish_loading_history();
+	if (hist.path == NULL || (hist.start == hist.end && is_entry_empty(hist.end))) {
+		return;
+	}
+
+	FILE *hist_file = fopen(hist.path, "we");
+	should_save_times = should_save_times || hist.is_extended;
 	if (hist.start <= hist.end) {
 		for (hist.current = hist.end; hist.current >= hist.start; --hist.current) {
-			fprintf(hist_file, "%s\n", hist.current->text);
+			write_history_entry(hist_file, hist.current, should_save_times);
 		}
 	} else {
 		for (hist.current = hist.end; hist.current >= hist.zero; --hist.current) {
-			fprintf(hist_file, "%s\n", hist.current->text);
+			write_history_entry(hist_file, hist.current, should_save_times);
 		}
 		for (hist.current = hist.cap; hist.current >= hist.start; --hist.current) {
-			fprintf(hist_file, "%s\n", hist.current->text);
+			write_history_entry(hist_file, hist.current, should_save_times);
 		}
 	}
 	fclose(hist_file);
 }
 
-static void clear_prompt(void)
+static FILE *script = NULL;
+
+void init_script(FILE *file)
+{
+	script = file;
+}
+
+// A single read can return several keys, e.g. when text is pasted, so input
+// is queued up and handed out a key at a time
+static char input[256];
+static size_t input_len = 0;
+
+// Entries are timed from when they're entered until they've finished running
+static struct timespec entry_begin;
+
+void finish_history_entry(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	double duration = (now.tv_sec - entry_begin.tv_sec) + (now.tv_nsec - entry_begin.tv_nsec) / 1e9;
+	hist.times[hist.end - hist.zero].duration = duration;
+	set_prompt_duration(duration);
+}
+
+static char *line = NULL;
+static size_t line_cap = 0;
+
+// Reads a raw line of input without going through the editor or the history,
+// e.g. for here-document bodies. The terminal is expected to be in canonical
+// mode whenever this is called interactively.
+char *get_next_line(char *prompt)
+{
+	if (script != NULL) {
+		ssize_t line_len = getline(&line, &line_cap, script);
+		if (line_len == -1) {
+			return NULL;
+		}
+		if (line_len > 0 && line[line_len - 1] == '\n') {
+			line[line_len - 1] = '\0';
+		}
+		return line;
+	}
+
+	write(STDOUT_FILENO, prompt, strlen(prompt));
+	size_t line_len = 0;
+	while (true) {
+		if (line_cap - line_len < 256) {
+			line_cap = (line_cap == 0) ? 256 : 2 * line_cap;
+			line = (char *) resize(line, line_cap * sizeof (char));
+		}
+		ssize_t count;
+		if (input_len > 0) {
+
+			// Whatever the editor already read ahead comes first
+			char *newline = memchr(input, '\n', input_len);
+			size_t queued_len = (newline == NULL) ? input_len : (size_t) (newline - input) + 1;
+			if (queued_len > line_cap - line_len - 1) {
+				queued_len = line_cap - line_len - 1;
+			}
+			memcpy(line + line_len, input, queued_len);
+			memmove(input, input + queued_len, input_len - queued_len);
+			input_len -= queued_len;
+			count = (ssize_t) queued_len;
+		} else {
+			count = read(STDIN_FILENO, line + line_len, line_cap - line_len - 1);
+		}
+		if (count <= 0) {
+			if (line_len == 0) {
+				return NULL;
+			}
+			break;
+		}
+		line_len += count;
+		if (line[line_len - 1] == '\n') {
+			--line_len;
+			break;
+		}
+	}
+	line[line_len] = '\0';
+	return line;
+}
+
+// Lead bytes say how long their character is, anything that isn't one is
+// taken as a character of its own
+static size_t get_utf8_len(char lead)
+{
+	unsigned char byte = (unsigned char) lead;
+	if (byte >= 0xc0 && byte < 0xe0) {
+		return 2;
+	} else if (byte >= 0xe0 && byte < 0xf0) {
+		return 3;
+	} else if (byte >= 0xf0 && byte < 0xf8) {
+		return 4;
+	}
+	return 1;
+}
+
+#define UTF8_INVALID 0xfffd
+
+static size_t decode_utf8(char *text, size_t len, unsigned *codepoint)
+{
+	size_t char_len = get_utf8_len(text[0]);
+	*codepoint = (unsigned char) text[0];
+	if (char_len == 1) {
+		if (*codepoint >= 0x80) {
+			*codepoint = UTF8_INVALID;
+		}
+		return 1;
+	}
+	if (char_len > len) {
+		*codepoint = UTF8_INVALID;
+		return 1;
+	}
+	*codepoint &= 0x3f >> (char_len - 1);
+	for (size_t i = 1; i < char_len; ++i) {
+		if (((unsigned char) text[i] & 0xc0) != 0x80) {
+			*codepoint = UTF8_INVALID;
+			return 1;
+		}
+		*codepoint = (*codepoint << 6) | ((unsigned char) text[i] & 0x3f);
+	}
+	return char_len;
+}
+
+typedef struct {
+	unsigned first;
+	unsigned last;
+} Codepoint_Range;
+
+// Combining marks, zero width spaces and joiners and variation selectors
+static Codepoint_Range zero_width[] = {
+	{0x0300, 0x036f}, {0x0483, 0x0489}, {0x0591, 0x05bd}, {0x0610, 0x061a},
+	{0x064b, 0x065f}, {0x0e31, 0x0e31}, {0x0e34, 0x0e3a}, {0x0e47, 0x0e4e},
+	{0x1ab0, 0x1aff}, {0x1dc0, 0x1dff}, {0x200b, 0x200f}, {0x20d0, 0x20ff},
+	{0xfe00, 0xfe0f}, {0xfe20, 0xfe2f}, {0x1f3fb, 0x1f3ff}, {0xe0100, 0xe01ef},
+};
+
+// East Asian wide and full width characters and emoji
+static Codepoint_Range double_width[] = {
+	{0x1100, 0x115f}, {0x231a, 0x231b}, {0x2329, 0x232a}, {0x23e9, 0x23ec},
+	{0x25fd, 0x25fe}, {0x2614, 0x2615}, {0x2648, 0x2653}, {0x26aa, 0x26ab},
+	{0x26bd, 0x26be}, {0x26c4, 0x26c5}, {0x26f2, 0x26f3}, {0x2705, 0x2705},
+	{0x270a, 0x270b}, {0x2728, 0x2728}, {0x274c, 0x274c}, {0x2753, 0x2755},
+	{0x2795, 0x2797}, {0x2b1b, 0x2b1c}, {0x2e80, 0x303e}, {0x3041, 0x33ff},
+	{0x3400, 0x4dbf}, {0x4e00, 0x9fff}, {0xa000, 0xa4cf}, {0xac00, 0xd7a3},
+	{0xf900, 0xfaff}, {0xfe30, 0xfe4f}, {0xff00, 0xff60}, {0xffe0, 0xffe6},
+	{0x1f300, 0x1f64f}, {0x1f680, 0x1f6ff}, {0x1f900, 0x1f9ff}, {0x20000, 0x3fffd},
+};
+
+static bool is_in_ranges(unsigned codepoint, Codepoint_Range *ranges, size_t count)
+{
+	for (size_t i = 0; i < count; ++i) {
+		if (codepoint >= ranges[i].first && codepoint <= ranges[i].last) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static size_t get_width(unsigned codepoint)
+{
+	if (codepoint < 0x300) {
+		return 1;
+	} else if (is_in_ranges(codepoint, zero_width, sizeof (zero_width) / sizeof (Codepoint_Range))) {
+		return 0;
+	} else if (is_in_ranges(codepoint, double_width, sizeof (double_width) / sizeof (Codepoint_Range))) {
+		return 2;
+	}
+	return 1;
+}
+
+#define ZERO_WIDTH_JOINER 0x200d
+
+// Characters are kept together with the marks that combine with them and
+// anything joined on with a zero width joiner, which is close enough to
+// grapheme clusters for moving around a command line
+static bool is_cluster_start(char *text, size_t len, size_t i)
+{
+	if (i == 0 || i >= len) {
+		return true;
+	} else if (((unsigned char) text[i] & 0xc0) == 0x80) {
+		return false;
+	}
+	unsigned codepoint, previous;
+	decode_utf8(text + i, len - i, &codepoint);
+	if (get_width(codepoint) == 0) {
+		return false;
+	}
+	size_t previous_start = i - 1;
+	while (previous_start > 0 && ((unsigned char) text[previous_start] & 0xc0) == 0x80 && i - previous_start < 4) {
+		--previous_start;
+	}
+	decode_utf8(text + previous_start, len - previous_start, &previous);
+	return previous != ZERO_WIDTH_JOINER;
+}
+
+static size_t get_next_cluster(char *text, size_t len, size_t i)
+{
+	do {
+		++i;
+	} while (!is_cluster_start(text, len, i));
+	return i;
+}
+
+static size_t get_previous_cluster(char *text, size_t len, size_t i)
+{
+	do {
+		--i;
+	} while (!is_cluster_start(text, len, i));
+	return i;
+}
+
+// The line being edited keeps its free space at the cursor, so typing or
+// deleting there never has to move the rest of the line
+typedef struct {
+	char *text;
+	size_t cap;
+	size_t gap_start; // Where the cursor is
+	size_t gap_end;
+} Gap_Buffer;
+static Gap_Buffer edit;
+
+static size_t get_gap_len(Gap_Buffer *gap)
+{
+	return gap->cap - (gap->gap_end - gap->gap_start);
+}
+
+static void reserve_gap(Gap_Buffer *gap, size_t len)
+{
+	if (gap->gap_end - gap->gap_start >= len) {
+		return;
+	}
+	size_t tail_len = gap->cap - gap->gap_end;
+	size_t cap = (gap->cap == 0) ? BUFF_CAP + 1 : 2 * gap->cap;
+	while (cap - get_gap_len(gap) < len) {
+		cap *= 2;
+	}
+	gap->text = (char *) resize(gap->text, cap * sizeof (char));
+	memmove(gap->text + cap - tail_len, gap->text + gap->gap_end, tail_len);
+	gap->gap_end = cap - tail_len;
+	gap->cap = cap;
+}
+
+static void move_gap(Gap_Buffer *gap, size_t to)
+{
+	if (to < gap->gap_start) {
+		size_t count = gap->gap_start - to;
+		memmove(gap->text + gap->gap_end - count, gap->text + to, count);
+		gap->gap_start -= count;
+		gap->gap_end -= count;
+	} else if (to > gap->gap_start) {
+		size_t count = to - gap->gap_start;
+		memmove(gap->text + gap->gap_start, gap->text + gap->gap_end, count);
+		gap->gap_start += count;
+		gap->gap_end += count;
+	}
+}
+
+static void insert_gap(Gap_Buffer *gap, char *text, size_t len)
+{
+	reserve_gap(gap, len);
+	memcpy(gap->text + gap->gap_start, text, len);
+	gap->gap_start += len;
+}
+
+static void set_gap(Gap_Buffer *gap, char *text, size_t len)
+{
+	gap->gap_start = 0;
+	gap->gap_end = gap->cap;
+	insert_gap(gap, text, len);
+}
+
+static char get_gap_byte(Gap_Buffer *gap, size_t i)
+{
+	return (i < gap->gap_start) ? gap->text[i] : gap->text[i + gap->gap_end - gap->gap_start];
+}
+
+static void copy_gap(Gap_Buffer *gap, size_t from, size_t to, char *out)
+{
+	if (from < gap->gap_start) {
+		size_t count = ((to < gap->gap_start) ? to : gap->gap_start) - from;
+		memcpy(out, gap->text + from, count);
+		out += count;
+		from += count;
+	}
+	if (from < to) {
+		memcpy(out, gap->text + from + gap->gap_end - gap->gap_start, to - from);
+	}
+}
+
+// Checks a few characters either side of an offset in the gap buffer, which
+// is all is_cluster_start ever looks at
+static bool is_gap_cluster_start(Gap_Buffer *gap, size_t i)
+{
+	char window[16];
+	size_t len = get_gap_len(gap);
+	size_t from = (i > 8) ? i - 8 : 0, to = (i + 8 < len) ? i + 8 : len;
+	copy_gap(gap, from, to, window);
+	return is_cluster_start(window, to - from, i - from);
+}
+
+// What the terminal shows after the prompt, so redrawing a line only has to
+// send the part that differs from what's already there. Which column every
+// byte is drawn at is kept along with it, so moving the cursor never has to
+// measure the line again. After every keystroke it holds the same text as
+// the line being edited, in the same styles.
+typedef struct {
+	char *text;
+	size_t *columns;
+	unsigned char *styles;
+	size_t cap;
+	size_t len;
+	size_t cursor;
+	size_t prompt_width; // Columns the prompt takes up before the line
+
+	// Columns from shift_from on are all off by shift, which is how much the
+	// edits before them changed the width of the line, so the end of the line
+	// isn't measured again on every keystroke. It wraps around like unsigned
+	// arithmetic does when the line gets narrower.
+	size_t shift_from;
+	size_t shift;
+} Display;
+static Display display;
+
+static size_t get_column(size_t i)
+{
+	return (i >= display.shift_from) ? display.columns[i] + display.shift : display.columns[i];
+}
+
+static void reserve_display(size_t len)
+{
+	if (len + 1 <= display.cap) {
+		return;
+	}
+	display.cap = (display.cap == 0) ? BUFF_CAP + 1 : display.cap;
+	while (display.cap < len + 1) {
+		display.cap *= 2;
+	}
+	display.text = (char *) resize(display.text, display.cap * sizeof (char));
+	display.columns = (size_t *) resize(display.columns, (display.cap + 1) * sizeof (size_t));
+	display.styles = (unsigned char *) resize(display.styles, display.cap * sizeof (unsigned char));
+}
+
+// Everything a keystroke draws goes out in one write
+static char output[8192];
+static size_t output_len = 0;
+
+static void flush_output(void)
+{
+	if (output_len > 0) {
+		write(STDOUT_FILENO, output, output_len);
+		output_len = 0;
+	}
+}
+
+static void emit(char *bytes, size_t len)
+{
+	if (output_len + len > sizeof (output)) {
+		flush_output();
+	}
+	if (len > sizeof (output)) {
+		write(STDOUT_FILENO, bytes, len);
+		return;
+	}
+	memcpy(output + output_len, bytes, len);
+	output_len += len;
+}
+
+static void emit_sequence(size_t count, char command)
+{
+	char sequence[32];
+	int len = snprintf(sequence, sizeof (sequence), "\033[%zu%c", count, command);
+	emit(sequence, (size_t) len);
+}
+
+// Writes part of the line in its styles, leaving the terminal in the default one
+static void emit_styled(size_t from, size_t to)
+{
+	unsigned char style = HUSH_STYLE_NONE;
+	for (size_t i = from, run_end; i < to; i = run_end) {
+		for (run_end = i + 1; run_end < to && display.styles[run_end] == display.styles[i]; ++run_end);
+		if (display.styles[i] != style) {
+			style = display.styles[i];
+			emit(get_style_sequence(style), strlen(get_style_sequence(style)));
+		}
+		emit(display.text + i, run_end - i);
+	}
+	if (style != HUSH_STYLE_NONE) {
+		emit(get_style_sequence(HUSH_STYLE_NONE), strlen(get_style_sequence(HUSH_STYLE_NONE)));
+	}
+}
+
+// Which of the terminal's rows a column of the line is on, counting from the
+// one the prompt starts on
+static size_t get_row(size_t column)
+{
+	return (display.prompt_width + column) / terminal_width;
+}
+
+// A terminal that's just filled a row only moves onto the next one with the
+// next character, so a space is written there and the cursor taken back
+static void wrap_cursor(size_t column)
+{
+	size_t position = display.prompt_width + column;
+	if (position > 0 && position % terminal_width == 0) {
+		emit(" \r", 2);
+	}
+}
+
+// Moves between rows come first, going down with new lines since those also
+// scroll when the line reaches the bottom of the screen. Short moves along a
+// row are cheaper as backspaces.
+static void move_column(size_t from, size_t to)
+{
+	size_t from_row = get_row(from), to_row = get_row(to);
+	size_t from_column = (display.prompt_width + from) % terminal_width;
+	size_t to_column = (display.prompt_width + to) % terminal_width;
+	if (to_row < from_row) {
+		emit_sequence(from_row - to_row, 'A');
+	}
+	for (; from_row < to_row; ++from_row) {
+		emit("\r\n", 2);
+		from_column = 0;
+	}
+	if (to_column < from_column) {
+		if (from_column - to_column <= 4) {
+			emit("\b\b\b\b", from_column - to_column);
+		} else {
+			emit_sequence(from_column - to_column, 'D');
+		}
+	} else if (to_column > from_column) {
+		emit_sequence(to_column - from_column, 'C');
+	}
+}
+
+// Short moves right along a row are cheaper by printing what's already shown
+static void move_display_cursor(size_t to)
+{
+	size_t from_column = get_column(display.cursor), to_column = get_column(to);
+	if (to_column > from_column && to_column - from_column <= 4 && get_row(from_column) == get_row(to_column)) {
+		emit_styled(display.cursor, to);
+	} else {
+		move_column(from_column, to_column);
+	}
+	display.cursor = to;
+}
+
+// The rest of the newest entry starting with the line is suggested after it
+// in gray. It's drawn past the end of the display, so none of the line's own
+// bookkeeping has to know about it.
+typedef struct {
+	size_t node; // Where the line leads in the index
+	size_t depth; // How much of the line has been followed there
+	char *shown; // The end of an entry that's drawn after the line
+	size_t shown_len;
+	bool is_stale; // Part of a character may be left after the line
+} Suggestion;
+static Suggestion suggestion;
+
+// Escape sequences in the prompt take up no room, and only its last line counts
+static size_t measure_prompt(char *prompt, size_t len)
+{
+	size_t width = 0;
+	for (size_t i = 0; i < len;) {
+		if (prompt[i] == '\033' && i + 1 < len && prompt[i + 1] == '[') {
+			for (i += 2; i < len && (prompt[i] < 0x40 || prompt[i] > 0x7e); ++i);
+			++i;
+		} else if (prompt[i] == '\033' && i + 1 < len && prompt[i + 1] == ']') {
+			for (i += 2; i < len && prompt[i] != '\a' && prompt[i] != '\033'; ++i);
+			i += (i + 1 < len && prompt[i] == '\033') ? 2 : 1;
+		} else if (prompt[i] == '\n' || prompt[i] == '\r') {
+			width = 0;
+			++i;
+		} else {
+			unsigned codepoint;
+			i += decode_utf8(prompt + i, len - i, &codepoint);
+			width += get_width(codepoint);
+		}
+	}
+	return width;
+}
+
+// Called once the prompt has been written, with what it was
+static void reset_display(char *prompt, size_t prompt_len)
+{
+	reserve_display(0);
+	display.len = display.cursor = display.columns[0] = 0;
+	display.shift_from = display.shift = 0;
+	display.prompt_width = measure_prompt(prompt, prompt_len);
+	wrap_cursor(0);
+	reset_highlight();
+	suggestion = (Suggestion) {.node = PREFIX_ROOT};
+}
+
+// Writing the end of the line over the suggestion leaves the rest of it
+// where it should be, so typing what's suggested draws nothing more
+static void skip_suggestion(size_t width)
 {
-	write(STDOUT_FILENO, "\r", 1);
-	for (size_t i = 0; i < (hist.current->end - hist.current->text) + hush_prompt_len; ++i) {
-		write(STDOUT_FILENO, " ", 1);
+	size_t skipped = 0, i = 0;
+	while (i < suggestion.shown_len && skipped < width) {
+		unsigned codepoint;
+		i += decode_utf8(suggestion.shown + i, suggestion.shown_len - i, &codepoint);
+		skipped += get_width(codepoint);
 	}
-	write(STDOUT_FILENO, "\r", 1);
-	write(STDOUT_FILENO, hush_prompt, hush_prompt_len);
+	for (; i < suggestion.shown_len && !is_cluster_start(suggestion.shown, suggestion.shown_len, i); ++i);
+	suggestion.is_stale = skipped > width;
+	suggestion.shown += i;
+	suggestion.shown_len -= i;
+}
+
+static void render_suggestion(void)
+{
+	suggestion.node = follow_prefix(suggestion.node, display.text + suggestion.depth, display.len - suggestion.depth);
+	suggestion.depth = display.len;
+	size_t slot;
+	unsigned long id = get_newest_entry(suggestion.node, &slot);
+	char *wanted = "";
+	if (display.len > 0 && id != 0 && hist.ids[slot] == id) {
+		wanted = hist.entries[slot] + display.len;
+	}
+	size_t wanted_len = strlen(wanted);
+	if (!suggestion.is_stale && wanted_len == suggestion.shown_len && memcmp(wanted, suggestion.shown, wanted_len) == 0) {
+		suggestion.shown = wanted;
+		return;
+	}
+
+	move_display_cursor(display.len);
+	size_t width = 0;
+	for (size_t i = 0; i < wanted_len;) {
+		unsigned codepoint;
+		i += decode_utf8(wanted + i, wanted_len - i, &codepoint);
+		width += get_width(codepoint);
+	}
+	size_t line_width = get_column(display.len);
+	if (wanted_len > 0) {
+		emit(get_style_sequence(HUSH_STYLE_SUGGESTION), strlen(get_style_sequence(HUSH_STYLE_SUGGESTION)));
+		emit(wanted, wanted_len);
+		emit(get_style_sequence(HUSH_STYLE_NONE), strlen(get_style_sequence(HUSH_STYLE_NONE)));
+		wrap_cursor(line_width + width);
+	}
+	if (suggestion.shown_len > 0 || suggestion.is_stale) {
+		emit("\033[J", 3);
+	}
+	if (width > 0) {
+		move_column(line_width + width, line_width);
+	}
+	suggestion.shown = wanted;
+	suggestion.shown_len = wanted_len;
+	suggestion.is_stale = false;
+}
+
+// Takes the suggestion off the screen before leaving the line, from its end
+// so nothing after it is written over a wrapped line
+static void clear_suggestion(void)
+{
+	move_display_cursor(display.len);
+	if (suggestion.shown_len > 0) {
+		emit("\033[J", 3);
+		suggestion.shown_len = 0;
+	}
+	flush_output();
+}
+
+// Draws an edit that replaced the shown line's bytes from edit_begin to
+// old_end with the edited line's up to new_end, which the keys that edit
+// know without comparing the lines. The rest of the line is shifted in place
+// by inserting or deleting characters, which terminals only do within a row,
+// so once the line wraps the rest of it is written out again instead. Around
+// the edit, whatever it changed the style of is written again too, e.g. the
+// rest of the line after an opening quote.
+static void render_edit(size_t edit_begin, size_t old_end, size_t new_end)
+{
+	size_t len = get_gap_len(&edit);
+
+	// Whole characters are redrawn, never parts of them
+	while (!is_gap_cluster_start(&edit, edit_begin) || !is_cluster_start(display.text, display.len, edit_begin)) {
+		--edit_begin;
+	}
+	while (new_end < len && (!is_gap_cluster_start(&edit, new_end) || !is_cluster_start(display.text, display.len, old_end))) {
+		++new_end;
+		++old_end;
+	}
+
+	if (edit_begin != old_end || edit_begin != new_end) {
+		if (edit_begin < suggestion.depth) {
+			suggestion.node = PREFIX_ROOT;
+			suggestion.depth = 0;
+		}
+		size_t suffix = display.len - old_end;
+		size_t old_line_width = get_column(display.len);
+		size_t begin_column = get_column(edit_begin);
+		size_t old_width = get_column(old_end) - begin_column, new_width = 0;
+		move_display_cursor(edit_begin);
+
+		// The shift left by the last edit is folded into this one's, which
+		// only touches the columns between the two edits
+		if (display.shift_from < edit_begin) {
+			for (size_t i = display.shift_from; i < edit_begin; ++i) {
+				display.columns[i] += display.shift;
+			}
+		} else {
+			for (size_t i = old_end; i < display.shift_from && i <= display.len; ++i) {
+				display.columns[i] -= display.shift;
+			}
+		}
+
+		// The suffix only moves over, the rest is copied and measured again
+		reserve_display(len);
+		memmove(display.text + new_end, display.text + old_end, suffix);
+		memmove(display.columns + new_end, display.columns + old_end, (suffix + 1) * sizeof (size_t));
+		memmove(display.styles + new_end, display.styles + old_end, suffix);
+		copy_gap(&edit, edit_begin, new_end, display.text + edit_begin);
+		for (size_t i = edit_begin, column = begin_column; i < new_end;) {
+			unsigned codepoint;
+			size_t char_len = decode_utf8(display.text + i, new_end - i, &codepoint);
+			for (size_t j = 0; j < char_len; ++j) {
+				display.columns[i + j] = column;
+			}
+			column += get_width(codepoint);
+			new_width += get_width(codepoint);
+			i += char_len;
+		}
+		display.shift_from = new_end;
+		display.shift += new_width - old_width;
+		size_t line_width = old_line_width - old_width + new_width;
+		size_t widest = (line_width > old_line_width) ? line_width : old_line_width;
+		bool is_wrapped = display.prompt_width + widest + suggestion.shown_len >= terminal_width;
+
+		// The edit can change the style of what's around it
+		size_t dirty_begin, dirty_end;
+		unsigned char *styles = highlight_line(display.text, len, edit_begin, old_end, new_end, &dirty_begin, &dirty_end);
+		size_t begin = edit_begin, end = new_end;
+		for (size_t i = dirty_begin; i < edit_begin && begin == edit_begin; ++i) {
+			begin = (styles[i] != display.styles[i]) ? i : begin;
+		}
+		for (size_t i = dirty_end; i > new_end && end == new_end; --i) {
+			end = (styles[i - 1] != display.styles[i - 1]) ? i : end;
+		}
+		for (; !is_cluster_start(display.text, len, begin); --begin);
+		for (; end < len && !is_cluster_start(display.text, len, end); ++end);
+		end = is_wrapped ? len : end;
+		memcpy(display.styles + begin, styles + begin, end - begin);
+		move_display_cursor(begin);
+
+		if (is_wrapped) {
+			emit_styled(begin, len);
+			wrap_cursor(line_width);
+			if (old_line_width > line_width || suggestion.shown_len > 0 || suggestion.is_stale) {
+				emit("\033[J", 3);
+			}
+			suggestion.shown_len = 0;
+			suggestion.is_stale = false;
+		} else {
+			if (new_width > old_width && end < len) {
+				emit_sequence(new_width - old_width, '@');
+			}
+			emit_styled(begin, end);
+			if (old_width > new_width) {
+				if (end < len) {
+					emit_sequence(old_width - new_width, 'P');
+				} else {
+					emit("\033[K", 3);
+					suggestion.shown_len = 0;
+				}
+			} else if (end == len) {
+				skip_suggestion(new_width - old_width);
+			}
+		}
+		display.len = len;
+		display.cursor = end;
+	}
+	render_suggestion();
+	move_display_cursor(edit.gap_start);
+	flush_output();
+}
+
+// Moving the cursor around the line only has to move it on the terminal
+static void render_cursor(void)
+{
+	move_display_cursor(edit.gap_start);
+	flush_output();
+}
+
+// When the whole line was replaced, only what's between the common prefix and
+// suffix of the shown line and the edited one gets written
+static void render(void)
+{
+	size_t len = get_gap_len(&edit);
+	size_t prefix = 0, suffix = 0;
+	while (prefix < len && prefix < display.len && get_gap_byte(&edit, prefix) == display.text[prefix]) {
+		++prefix;
+	}
+	while (suffix < len - prefix && suffix < display.len - prefix && get_gap_byte(&edit, len - suffix - 1) == display.text[display.len - suffix - 1]) {
+		++suffix;
+	}
+	render_edit(prefix, display.len - suffix, len - suffix);
+}
+
+// Draws the prompt again in front of the line being edited
+static void redraw_prompt(void)
+{
+	size_t row = get_row(get_column(display.cursor));
+	if (row > 0) {
+		emit_sequence(row, 'A');
+	}
+	size_t prompt_len;
+	char *prompt = get_prompt(&prompt_len);
+	emit("\r", 1);
+	emit(prompt, prompt_len);
+	emit("\033[J", 3);
+	reset_display(prompt, prompt_len);
+	render();
+}
+
+// The end of the history is the line being typed, which the edit buffer is
+// saved to before looking at any other entry
+static void save_edit(char **entry)
+{
+	size_t len = get_gap_len(&edit);
+	*entry = (char *) resize(*entry, (len + 1) * sizeof (char));
+	copy_gap(&edit, 0, len, *entry);
+	(*entry)[len] = '\0';
+}
+
+static void load_entry(char **entry)
+{
+	char *text = get_entry(entry);
+	set_gap(&edit, text, strlen(text));
+	render();
+}
+
+// Editing an entry from the history turns it into the line being typed
+static void edit_current(void)
+{
+	hist.current = hist.end;
 }
 
 static Buffer result;
 
+// For the rest of a key that came in over several reads
+static bool read_more_input(void)
+{
+	ssize_t count = (input_len < sizeof (input)) ? read(STDIN_FILENO, input + input_len, sizeof (input) - input_len) : 0;
+	if (count <= 0) {
+		return false;
+	}
+	input_len += (size_t) count;
+	return true;
+}
+
+// The terminal's rows are taken to have been wrapped again at the new width,
+// as most terminals do
+static bool take_resize(void)
+{
+	if (!is_resized) {
+		return false;
+	}
+	is_resized = false;
+	size_t width = terminal_width;
+	read_terminal_width();
+	return terminal_width != width;
+}
+
+// Wakes up with no key at all when the prompt has changed, e.g. once a slow
+// part of it has been worked out, or the terminal has been resized
+static void read_key(char *key)
+{
+	memset(key, 0, KEY_CAP);
+	if (input_len == 0) {
+		struct pollfd fds[2] = {{.fd = STDIN_FILENO, .events = POLLIN}, {.fd = get_prompt_fd(), .events = POLLIN}};
+		int count = is_resized ? -1 : poll(fds, 2, -1);
+		if ((count > 0 && fds[0].revents == 0 && (fds[1].revents & POLLIN)) || (count == -1 && is_resized)) {
+			return;
+		}
+	}
+	if (input_len == 0) {
+		ssize_t count = read(STDIN_FILENO, input, sizeof (input));
+		if (count <= 0) {
+			key[0] = '\004'; // The end of the input is the same as control-D
+			return;
+		}
+		input_len = (size_t) count;
+	}
+
+	// Control sequences run up to their final byte and SS3 ones, which some
+	// terminals send for the arrows, are one byte after 'ESC O`. Escape with
+	// anything else is an alt key, and a lone escape is the escape key. Keys
+	// too long to keep, like control-right, are still taken off the input
+	// whole so none of them is read as typed text.
+	size_t key_len = 1;
+	if (input[0] == '\033' && input_len > 1 && (input[1] == '[' || input[1] == 'O')) {
+		for (key_len = 2; true; ++key_len) {
+			if (key_len == input_len && !read_more_input()) {
+				break;
+			}
+			if (input[1] == 'O' || (input[key_len] >= 0x40 && input[key_len] <= 0x7e)) {
+				++key_len;
+				break;
+			}
+		}
+	} else if (input[0] == '\033' && input_len > 1) {
+		size_t char_len = get_utf8_len(input[1]);
+		while (input_len < 1 + char_len && read_more_input());
+		key_len = (1 + char_len < input_len) ? 1 + char_len : input_len;
+	}
+
+	// A multibyte character is one key, even if it came in over several reads
+	size_t char_len = get_utf8_len(input[0]);
+	if (char_len > 1) {
+		while (input_len < char_len && read_more_input());
+		key_len = (char_len < input_len) ? char_len : input_len;
+	}
+	memcpy(key, input, (key_len < KEY_CAP) ? key_len : KEY_CAP - 1);
+	memmove(input, input + key_len, input_len - key_len);
+	input_len -= key_len;
+}
+
+static Buffer *get_next_script_buffer(void)
+{
+	char *next = get_next_line(NULL);
+	if (next == NULL) {
+		return NULL;
+	}
+	set_buffer(&result, next, strlen(next));
+	return &result;
+}
+
+static bool is_first_prompt_shown = false;
+
 Buffer *get_next_buffer(void)
 {
+	if (script != NULL) {
+		return get_next_script_buffer();
+	}
+
 	// Set current buffer to the next buffer if current buffer has text
-	if (hist.end->text != hist.end->end) {
+	if (!is_entry_empty(hist.end)) {
 		hist.end = (hist.end == hist.cap) ? hist.zero : hist.end + 1;
 		hist.current = hist.end;
 		if (hist.end == hist.start) {
 			hist.start = (hist.start == hist.cap) ? hist.zero : hist.start + 1;
 		}
+		hist.times[hist.end - hist.zero].start = 0;
+		hist.ids[hist.end - hist.zero] = 0;
 	}
-	clear_buffer(hist.current);
+	store_entry(hist.current, "", 0);
+	set_gap(&edit, "", 0);
 
-	write(STDOUT_FILENO, hush_prompt, hush_prompt_len);
+	size_t prompt_len;
+	char *prompt = get_prompt(&prompt_len);
+	write(STDOUT_FILENO, prompt, prompt_len);
+	reset_display(prompt, prompt_len);
+	flush_output();
+	if (!is_first_prompt_shown) {
+		profile_phase("first prompt", 0);
+		is_first_prompt_shown = true;
+	}
 	while (true) {
-		char key[KEY_CAP] = {0};
-		read(STDIN_FILENO, key, KEY_CAP);
+		char key[KEY_CAP];
+		read_key(key);
+		finish_loading_history();
 		switch (key[0]) {
+			case '\0': { // The prompt changed or the terminal was resized
+				bool is_changed = take_prompt_update();
+				if (take_resize() || is_changed) {
+					redraw_prompt();
+				}
+				break;
+			}
 			// TODO: Handle control-C with signal.h?
 			case '\004': { // Control-D
+				clear_suggestion();
 				write(STDOUT_FILENO, "\n", 1);
-				if (hist.start != hist.end && hist.end->text == hist.end->end) {
+				if (hist.current == hist.end) {
+					save_edit(hist.end);
+				}
+				if (hist.start != hist.end && is_entry_empty(hist.end)) {
 					hist.end = (hist.end == hist.zero) ? hist.cap : hist.end - 1;
 				}
 				return NULL;
@@ -156,68 +1191,59 @@ Buffer *get_next_buffer(void)
 				break;
 			}
 			case '\012': { // New line
+				clear_suggestion();
 				write(STDOUT_FILENO, "\n", 1);
 
 				// Copy current buffer to end of history if you're going to run it
-				if (hist.current != hist.end) {
-					*hist.end = *hist.current;
-					hist.end->cursor = hist.end->text + (hist.current->cursor - hist.current->text);
-					hist.end->end = hist.end->text + (hist.current->end - hist.current->text);
-					hist.current = hist.end;
+				edit_current();
+				save_edit(hist.end);
+				if (!is_entry_empty(hist.end)) {
+					add_to_index(hist.end);
 				}
 
-				hist.end->cursor = hist.end->end;
-				*hist.end->end = '\0';
-				result = *hist.end; // Result gets clobbered in lexing
-				result.cursor = result.text;
-				result.end = result.text + (hist.end->end - hist.end->text);
+				hist.times[hist.end - hist.zero].start = time(NULL);
+				clock_gettime(CLOCK_MONOTONIC, &entry_begin);
+				set_buffer(&result, *hist.end, strlen(*hist.end)); // Result gets clobbered in lexing
 				return &result;
 			}
 			case '\033': {
-				if (key[1] == '[') {
+				if (key[1] == '[' || key[1] == 'O') {
 					switch (key[2]) {
 						case 'A': { // Up arrow
 							if (hist.current == hist.start) {
 								break;
 							}
-							clear_prompt();
-
-							hist.current->cursor = hist.current->end;
-							*hist.current->end = '\0';
-
+							if (hist.current == hist.end) {
+								save_edit(hist.end);
+							}
 							hist.current = (hist.current == hist.zero) ? hist.cap : hist.current - 1;
-							
-							write(STDOUT_FILENO, hist.current->text, strlen(hist.current->text));
-							hist.current->cursor = hist.current->end = hist.current->text + strlen(hist.current->text);
+							load_entry(hist.current);
 							break;
 						}
 						case 'B': { // Down arrow
 							if (hist.current == hist.end) {
 								break;
 							}
-
-							clear_prompt();
-
-							hist.current->cursor = hist.current->end;
-							*hist.current->end = '\0';
-
 							hist.current = (hist.current == hist.cap) ? hist.zero : hist.current + 1;
-
-							write(STDOUT_FILENO, hist.current->text, strlen(hist.current->text));
-							hist.current->cursor = hist.current->end = hist.current->text + strlen(hist.current->text);
+							load_entry(hist.current);
 							break;
 						}
-						case 'C': { // Right arrow
-							if (hist.current->cursor < hist.current->end) {
-								write(STDOUT_FILENO, hist.current->cursor, 1);
-								++hist.current->cursor;
+						case 'C': { // Right arrow, which takes the suggestion at the end of the line
+							if (edit.gap_start < display.len) {
+								move_gap(&edit, get_next_cluster(display.text, display.len, edit.gap_start));
+								render_cursor();
+							} else if (suggestion.shown_len > 0) {
+								edit_current();
+								size_t begin = edit.gap_start;
+								insert_gap(&edit, suggestion.shown, suggestion.shown_len);
+								render_edit(begin, begin, edit.gap_start);
 							}
 							break;
 						}
 						case 'D': { // Left arrow
-							if (hist.current->cursor > hist.current->text) {
-								write(STDOUT_FILENO, "\b", 1);
-								--hist.current->cursor;
+							if (edit.gap_start > 0) {
+								move_gap(&edit, get_previous_cluster(display.text, display.len, edit.gap_start));
+								render_cursor();
 							}
 						}
 					}
@@ -227,54 +1253,32 @@ Buffer *get_next_buffer(void)
 						is_not_zero += key[i];
 					}
 					if (!is_not_zero) { // Escape key
-						clear_prompt();
 						hist.current = hist.end;
-						clear_buffer(hist.end);
+						store_entry(hist.end, "", 0);
+						set_gap(&edit, "", 0);
+						render();
 					}
 				}
 				break;
 			}
 			case '\177': { // Backspace
-				if (hist.current->cursor > hist.current->text) {
-					write(STDOUT_FILENO, "\b", 1);
-					write(STDOUT_FILENO, hist.current->cursor, hist.current->end - hist.current->cursor);
-					write(STDOUT_FILENO, " ", 1);
-					for (size_t i = 0; i < (size_t) (hist.current->end - hist.current->cursor + 1); ++i) {
-						write(STDOUT_FILENO, "\b", 1);
-					}
-
-					if (hist.current != hist.end) {
-						*hist.end = *hist.current;
-						hist.end->cursor = hist.end->text + (hist.current->cursor - hist.current->text);
-						hist.end->end = hist.end->text + (hist.current->end - hist.current->text);
-						hist.current = hist.end;
-					}
-					memmove(hist.end->cursor - 1, hist.end->cursor, hist.end->end - hist.end->cursor + 1);
-					--hist.end->cursor;
-					--hist.end->end;
+				if (edit.gap_start > 0) {
+					edit_current();
+					size_t end = edit.gap_start;
+					edit.gap_start = get_previous_cluster(display.text, display.len, edit.gap_start);
+					render_edit(edit.gap_start, end, edit.gap_start);
 				}
 				break;
 			}
 			default: { // Printable character
-				if (hist.current->end - hist.current->text < BUFF_CAP && isprint(key[0])) {
-					write(STDOUT_FILENO, key, 1);
-
-					if (hist.current != hist.end) {
-						*hist.end = *hist.current;
-						hist.end->cursor = hist.end->text + (hist.current->cursor - hist.current->text);
-						hist.end->end = hist.end->text + (hist.current->end - hist.current->text);
-						hist.current = hist.end;
-					}
-					if (hist.end->cursor != hist.end->end) {
-						write(STDOUT_FILENO, hist.end->cursor, hist.end->end - hist.end->cursor + 1);
-						for (size_t i = 0; i < (size_t) (hist.end->end - hist.end->cursor); ++i) {
-							write(STDOUT_FILENO, "\b", 1);
-						}
-						memmove(hist.end->cursor + 1, hist.end->cursor, hist.end->end - hist.end->cursor + 1);
-					}
-					*hist.end->cursor = key[0];
-					++hist.end->cursor;
-					++hist.end->end;
+				size_t key_len = strlen(key);
+				unsigned codepoint;
+				bool is_printable = (key_len == 1) ? isprint(key[0]) : decode_utf8(key, key_len, &codepoint) == key_len && codepoint >= 0xa0;
+				if (is_printable) {
+					edit_current();
+					size_t begin = edit.gap_start;
+					insert_gap(&edit, key, key_len);
+					render_edit(begin, begin, edit.gap_start);
 				}
 			}
 		}
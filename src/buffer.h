@@ -1,19 +1,24 @@
 #ifndef BUFFER_H_
 #define BUFFER_H_
 
-#define BUFF_CAP 4095
+#define BUFF_CAP 4095 // How much lines have room for to start with, they grow as needed
 #define HIST_CAP 1000
 
 typedef struct {
-	char text[BUFF_CAP + 1];
+	char *text;
 	char *cursor;
 	char *end;
+	size_t cap;
 } Buffer;
 
 void init_terminal(void);
 void release_terminal(void);
 void init_history(void);
-void release_history(void);
+void release_history(bool should_save_times);
+void finish_history_entry(void);
+void init_script(FILE *file);
+void set_buffer(Buffer *buffer, char *text, size_t len);
 Buffer *get_next_buffer(void);
+char *get_next_line(char *prompt);
 
 #endif // BUFFER_H_
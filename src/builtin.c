@@ -0,0 +1,334 @@
+#include <ctype.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "buffer.h"
+#include "lexer.h"
+#include "arena.h"
+#include "parser.h"
+#include "builtin.h"
+#include "dirs.h"
+#include "exec.h"
+#include "funcs.h"
+#include "trace.h"
+#include "vars.h"
+
+bool exit_requested = false;
+int exit_status = 0;
+
+static int builtin_alias(char **args)
+{
+	if (args[1] == NULL) {
+		print_aliases();
+		return 0;
+	}
+	int status = 0;
+	for (size_t i = 1; args[i] != NULL; ++i) {
+		char *equals = strchr(args[i], '=');
+		if (equals == NULL) {
+			Command_List *alias = get_alias(args[i]);
+			if (alias == NULL) {
+				fprintf(stderr, "hush: alias: %s not found\n", args[i]);
+				status = 1;
+			} else {
+				printf("alias %s='%s'\n", args[i], alias->text);
+			}
+		} else if (equals == args[i] || !define_alias(args[i], equals - args[i], equals + 1)) {
+			status = 1;
+		}
+	}
+	return status;
+}
+
+// How many loops break and continue leave, capped at how deep they are
+static bool get_loop_levels(char **args, size_t *levels)
+{
+	if (loop_depth == 0) {
+		fprintf(stderr, "hush: %s: only meaningful in a loop\n", args[0]);
+		return false;
+	}
+	*levels = 1;
+	if (args[1] != NULL) {
+		char *end;
+		long count = strtol(args[1], &end, 10);
+		if (*end != '\0' || count < 1) {
+			fprintf(stderr, "hush: %s: loop count out of range: %s\n", args[0], args[1]);
+			return false;
+		}
+		*levels = (size_t) count;
+	}
+	if (*levels > loop_depth) {
+		*levels = loop_depth;
+	}
+	return true;
+}
+
+static int builtin_break(char **args)
+{
+	size_t levels;
+	if (!get_loop_levels(args, &levels)) {
+		return 1;
+	}
+	break_levels = levels;
+	return 0;
+}
+
+// Both cd and z end up here, so every directory changed to is remembered
+static bool change_dir(char *path, bool should_print)
+{
+	char *old_pwd = getcwd(NULL, 0);
+	if (chdir(path) == -1) {
+		free(old_pwd);
+		return false;
+	}
+	char *pwd = getcwd(NULL, 0);
+	if (old_pwd != NULL) {
+		set_var("OLDPWD", 6, old_pwd);
+	}
+	if (pwd != NULL) {
+		set_var("PWD", 3, pwd);
+		visit_dir(pwd);
+		if (should_print) {
+			printf("%s\n", pwd);
+		}
+	}
+	free(old_pwd);
+	free(pwd);
+	return true;
+}
+
+// Where a name was found in CDPATH is remembered, so it's only searched for
+// again if that directory is gone
+static int builtin_cd(char **args)
+{
+	char *name = args[1];
+	bool should_print = false;
+	if (name == NULL) {
+		name = get_var("HOME", 4);
+	} else if (strcmp(name, "-") == 0) {
+		name = get_var("OLDPWD", 6);
+		should_print = true;
+	}
+	if (name == NULL) {
+		fprintf(stderr, "hush: cd: %s not set\n", (args[1] == NULL) ? "HOME" : "OLDPWD");
+		return 1;
+	}
+
+	bool is_from_cdpath;
+	char *path = find_cd_dir(name, &is_from_cdpath);
+	bool is_changed = change_dir(path, should_print || is_from_cdpath);
+	if (!is_changed && forget_cd_dir(name)) {
+		free(path);
+		path = find_cd_dir(name, &is_from_cdpath);
+		is_changed = change_dir(path, should_print || is_from_cdpath);
+	}
+	free(path);
+	if (!is_changed) {
+		fprintf(stderr, "hush: cd: unable to change directory to '%s`\n", name);
+		return 1;
+	}
+	return 0;
+}
+
+static int builtin_continue(char **args)
+{
+	size_t levels;
+	if (!get_loop_levels(args, &levels)) {
+		return 1;
+	}
+	continue_levels = levels;
+	return 0;
+}
+
+static int builtin_echo(char **args)
+{
+	for (size_t i = 1; args[i] != NULL; ++i) {
+		printf(i == 1 ? "%s" : " %s", args[i]);
+	}
+	printf("\n");
+	return 0;
+}
+
+static int builtin_exit(char **args)
+{
+	exit_requested = true;
+	exit_status = (args[1] != NULL) ? (int) strtol(args[1], (char **) NULL, 10) : last_status;
+	return exit_status;
+}
+
+static int builtin_export(char **args)
+{
+	if (args[1] == NULL) {
+		print_exported_vars();
+		return 0;
+	}
+	int status = 0;
+	for (size_t i = 1; args[i] != NULL; ++i) {
+		size_t name_len = get_assignment_name_len(args[i]);
+		if (name_len > 0) {
+			set_var(args[i], name_len, args[i] + name_len + 1);
+		} else {
+			for (; isalnum(args[i][name_len]) || args[i][name_len] == '_'; ++name_len);
+			if (name_len == 0 || isdigit(args[i][0]) || args[i][name_len] != '\0') {
+				fprintf(stderr, "hush: export: not a valid name: %s\n", args[i]);
+				status = 1;
+				continue;
+			}
+		}
+		export_var(args[i], name_len);
+	}
+	return status;
+}
+
+static int builtin_pwd(char **args)
+{
+	(void) args;
+	char cwd[PATH_MAX];
+	if (getcwd(cwd, PATH_MAX) == NULL) {
+		fprintf(stderr, "hush: pwd: unable to get current directory\n");
+		return 1;
+	}
+	printf("%s\n", cwd);
+	return 0;
+}
+
+static int builtin_return(char **args)
+{
+	if (function_depth == 0) {
+		fprintf(stderr, "hush: return: can only return from a function\n");
+		return 1;
+	}
+	return_requested = true;
+	return (args[1] != NULL) ? (int) strtol(args[1], (char **) NULL, 10) : last_status;
+}
+
+// Traces go to $HUSH_TRACE when it's set
+static bool set_trace(bool is_on)
+{
+	if (!is_on) {
+		trace_stop();
+		return true;
+	}
+	char *path = get_var("HUSH_TRACE", 10);
+	return trace_start((path == NULL || *path == '\0') ? "hush_trace.json" : path);
+}
+
+typedef struct {
+	char *name;
+	bool *is_on; // NULL if it's only known through get
+	bool (*get)(void);
+	bool (*set)(bool is_on); // NULL if the flag is all there is to it
+} Shell_Option;
+
+static Shell_Option shell_options[] = {
+	{"explain", &is_explaining, NULL, NULL},
+	{"trace", NULL, trace_is_on, set_trace},
+};
+
+// Options are turned on with 'set -o name` and off with 'set +o name`
+static int builtin_set(char **args)
+{
+	size_t num_options = sizeof (shell_options) / sizeof (Shell_Option);
+	if (args[1] == NULL || (strcmp(args[1], "-o") == 0 && args[2] == NULL)) {
+		for (size_t i = 0; i < num_options; ++i) {
+			bool is_on = (shell_options[i].is_on != NULL) ? *shell_options[i].is_on : shell_options[i].get();
+			printf("%-16s%s\n", shell_options[i].name, is_on ? "on" : "off");
+		}
+		return 0;
+	}
+	int status = 0;
+	for (size_t i = 1; args[i] != NULL; ++i) {
+		bool is_on = strcmp(args[i], "-o") == 0;
+		if ((!is_on && strcmp(args[i], "+o") != 0) || args[i + 1] == NULL) {
+			fprintf(stderr, "hush: set: usage: set [-o|+o] option\n");
+			return 2;
+		}
+		char *name = args[++i];
+		Shell_Option *option = NULL;
+		for (size_t j = 0; j < num_options && option == NULL; ++j) {
+			option = (strcmp(shell_options[j].name, name) == 0) ? &shell_options[j] : NULL;
+		}
+		if (option == NULL) {
+			fprintf(stderr, "hush: set: no such option: %s\n", name);
+			status = 1;
+		} else if (option->set != NULL) {
+			status = option->set(is_on) ? status : 1;
+		} else {
+			*option->is_on = is_on;
+		}
+	}
+	return status;
+}
+
+static int builtin_unalias(char **args)
+{
+	int status = 0;
+	for (size_t i = 1; args[i] != NULL; ++i) {
+		if (!remove_alias(args[i])) {
+			fprintf(stderr, "hush: unalias: %s not found\n", args[i]);
+			status = 1;
+		}
+	}
+	return status;
+}
+
+static int builtin_unset(char **args)
+{
+	for (size_t i = 1; args[i] != NULL; ++i) {
+		unset_var(args[i], strlen(args[i]));
+	}
+	return 0;
+}
+
+// Jumps to the most frecent directory matching all the patterns in order,
+// skipping any that are gone
+static int builtin_z(char **args)
+{
+	if (args[1] == NULL) {
+		fprintf(stderr, "hush: z: usage: z pattern...\n");
+		return 2;
+	}
+	char *path;
+	while ((path = find_frecent_dir(args + 1)) != NULL) {
+		if (change_dir(path, false)) {
+			return 0;
+		}
+		forget_frecent_dir(path);
+	}
+	fprintf(stderr, "hush: z: no directory matches\n");
+	return 1;
+}
+
+#define FOR_BUILTINS(DO) \
+	DO(alias, false) \
+	DO(break, false) \
+	DO(cd, false) \
+	DO(continue, false) \
+	DO(echo, true) \
+	DO(exit, false) \
+	DO(export, false) \
+	DO(pwd, true) \
+	DO(return, false) \
+	DO(set, false) \
+	DO(unalias, false) \
+	DO(unset, false) \
+	DO(z, false) \
+
+#define BUILTIN_ENTRY(name, is_pure) { #name, builtin_##name, is_pure },
+static Builtin builtins[] = {
+	FOR_BUILTINS(BUILTIN_ENTRY)
+};
+
+Builtin *get_builtin(char *name)
+{
+	for (size_t i = 0; i < sizeof (builtins) / sizeof (Builtin); ++i) {
+		if (strcmp(builtins[i].name, name) == 0) {
+			return &builtins[i];
+		}
+	}
+	return NULL;
+}
@@ -0,0 +1,17 @@
+#ifndef BUILTIN_H_
+#define BUILTIN_H_
+
+typedef int (*Builtin_Func)(char **args);
+
+typedef struct {
+	char *name;
+	Builtin_Func func;
+	bool is_pure; // Doesn't touch shell state, so safe to run without a subshell
+} Builtin;
+
+extern bool exit_requested;
+extern int exit_status;
+
+Builtin *get_builtin(char *name);
+
+#endif // BUILTIN_H_
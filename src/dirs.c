@@ -0,0 +1,451 @@
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dirs.h"
+#include "fds.h"
+#include "table.h"
+#include "vars.h"
+
+#define NOT_IN_CDPATH ((size_t) -1)
+#define DB_SLACK 1024 // Records the database can have beyond twice its directories
+
+// Where a name was found in CDPATH, or that it's in none of its absolute
+// directories. Relative ones depend on where the shell is, so they're always
+// checked again.
+typedef struct {
+	size_t entry_index;
+	char *path;
+} Cd_Hit;
+
+static Table cd_cache;
+static unsigned long cd_cache_version = 0;
+
+static bool is_dir(char *path)
+{
+	struct stat info;
+	return stat(path, &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+static char *join_path(char *dir, size_t dir_len, char *name)
+{
+	size_t name_len = strlen(name);
+	char *path = (char *) malloc((dir_len + name_len + 2) * sizeof (char));
+	if (path == NULL) {
+		fprintf(stderr, "hush: unable to allocate memory\n");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(path, dir, dir_len);
+	path[dir_len] = '/';
+	memcpy(path + dir_len + 1, name, name_len + 1);
+	return path;
+}
+
+static void cache_cd_dir(char *name, size_t name_len, size_t entry_index, char *path)
+{
+	Cd_Hit *hit = (Cd_Hit *) malloc(sizeof (Cd_Hit));
+	if (hit == NULL || (path != NULL && (path = strdup(path)) == NULL)) {
+		fprintf(stderr, "hush: unable to allocate memory\n");
+		exit(EXIT_FAILURE);
+	}
+	*hit = (Cd_Hit) {.entry_index = entry_index, .path = path};
+	table_insert(&cd_cache, name, name_len)->value = hit;
+}
+
+bool forget_cd_dir(char *name)
+{
+	Table_Entry *entry = table_find(&cd_cache, name, strlen(name));
+	if (entry == NULL || entry->value == NULL) {
+		return false;
+	}
+	free(((Cd_Hit *) entry->value)->path);
+	free(entry->value);
+	entry->value = NULL;
+	return true;
+}
+
+// Only names found through a directory other than the current one count as
+// being from CDPATH, since those are the ones cd prints
+char *find_cd_dir(char *name, bool *is_from_cdpath)
+{
+	*is_from_cdpath = false;
+	char *cdpath = get_var("CDPATH", 6);
+	bool is_dot = name[0] == '.' && (name[1] == '\0' || name[1] == '/' || (name[1] == '.' && (name[2] == '\0' || name[2] == '/')));
+	if (name[0] == '/' || is_dot || cdpath == NULL || *cdpath == '\0') {
+		return strdup(name);
+	}
+	if (cd_cache_version != cdpath_version) {
+		for (size_t i = 0; i < cd_cache.cap; ++i) {
+			if (cd_cache.entries[i].value != NULL) {
+				forget_cd_dir(cd_cache.entries[i].key);
+			}
+		}
+		cd_cache_version = cdpath_version;
+	}
+
+	size_t name_len = strlen(name);
+	Table_Entry *entry = table_find(&cd_cache, name, name_len);
+	Cd_Hit *hit = (entry == NULL) ? NULL : (Cd_Hit *) entry->value;
+	char *dir = cdpath;
+	for (size_t i = 0;; ++i) {
+		char *dir_end = strchr(dir, ':');
+		size_t dir_len = (dir_end == NULL) ? strlen(dir) : (size_t) (dir_end - dir);
+		bool is_absolute = dir_len > 0 && dir[0] == '/';
+		if (is_absolute && hit != NULL && i == hit->entry_index) {
+			*is_from_cdpath = true;
+			return strdup(hit->path);
+		} else if (!is_absolute || hit == NULL) {
+			char *path = (dir_len == 0) ? join_path(".", 1, name) : join_path(dir, dir_len, name);
+			if (is_dir(path)) {
+				if (is_absolute) {
+					cache_cd_dir(name, name_len, i, path);
+				}
+				*is_from_cdpath = dir_len > 0 && !(dir_len == 1 && dir[0] == '.');
+				return path;
+			}
+			free(path);
+		}
+		if (dir_end == NULL) {
+			break;
+		}
+		dir = dir_end + 1;
+	}
+	if (hit == NULL) {
+		cache_cd_dir(name, name_len, NOT_IN_CDPATH, NULL);
+	}
+	return strdup(name);
+}
+
+// Visits are appended to the database as 'rank time path` lines, so shells
+// running at once never have to rewrite it. Only what was appended since the
+// last lookup is mapped and read in, and once there are more than twice as
+// many lines as directories it's compacted into one line for each of them.
+// Anything another shell appends while that happens is lost.
+typedef struct {
+	char *path; // The key in db_dirs
+	double rank;
+	time_t last_visit;
+} Frecent_Dir;
+
+// Which directories have each run of three bytes in them, ignoring case,
+// lowest first
+typedef struct {
+	uint32_t *ids;
+	size_t count;
+	size_t cap;
+} Posting_List;
+
+static char *db_path = NULL;
+static Table db_dirs;
+static Frecent_Dir **dirs = NULL;
+static size_t num_dirs = 0;
+static size_t dirs_cap = 0;
+static Table trigrams;
+static off_t loaded_size = 0;
+static ino_t loaded_inode = 0;
+static size_t num_records = 0;
+
+void init_dirs(char *path)
+{
+	free(db_path);
+	db_path = NULL;
+	if (path != NULL) {
+		db_path = strdup(path);
+		return;
+	}
+	char *home = get_var("HOME", 4);
+	if (home != NULL && *home != '\0') {
+		db_path = join_path(home, strlen(home), ".hush_dirs");
+	}
+}
+
+static void refresh_db(void);
+
+// The database is looked at to see if it needs compacting whenever it's
+// doubled in size since then, so shells that only ever cd keep it small too
+void visit_dir(char *path)
+{
+	if (db_path == NULL || strchr(path, '\n') != NULL) {
+		return;
+	}
+	int fd = open_fd(db_path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+	if (fd == -1) {
+		return;
+	}
+
+	// One write so lines from different shells never interleave
+	size_t len = strlen(path) + 32;
+	char *line = (char *) malloc(len * sizeof (char));
+	if (line != NULL) {
+		int line_len = snprintf(line, len, "1 %ld %s\n", (long) time(NULL), path);
+		write(fd, line, (size_t) line_len);
+		free(line);
+	}
+	off_t size = lseek(fd, 0, SEEK_CUR);
+	close_fd(fd);
+	if (size > 2 * loaded_size + DB_SLACK * 64) {
+		refresh_db();
+	}
+}
+
+static void index_dir(char *path, size_t path_len, uint32_t id)
+{
+	for (size_t i = 0; i + 3 <= path_len; ++i) {
+		char key[3] = {tolower((unsigned char) path[i]), tolower((unsigned char) path[i + 1]), tolower((unsigned char) path[i + 2])};
+		Table_Entry *entry = table_insert(&trigrams, key, 3);
+		if (entry->value == NULL && (entry->value = calloc(1, sizeof (Posting_List))) == NULL) {
+			fprintf(stderr, "hush: unable to allocate memory\n");
+			exit(EXIT_FAILURE);
+		}
+		Posting_List *list = (Posting_List *) entry->value;
+		if (list->count > 0 && list->ids[list->count - 1] == id) {
+			continue;
+		}
+		if (list->count == list->cap) {
+			list->cap = (list->cap == 0) ? 4 : 2 * list->cap;
+			list->ids = (uint32_t *) realloc(list->ids, list->cap * sizeof (uint32_t));
+			if (list->ids == NULL) {
+				fprintf(stderr, "hush: unable to allocate memory\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+		list->ids[list->count++] = id;
+	}
+}
+
+static void add_record(char *path, size_t path_len, double rank, time_t last_visit)
+{
+	++num_records;
+	Table_Entry *entry = table_insert(&db_dirs, path, path_len);
+	if (entry->value == NULL) {
+		if (num_dirs == dirs_cap) {
+			dirs_cap = (dirs_cap == 0) ? 256 : 2 * dirs_cap;
+			dirs = (Frecent_Dir **) realloc(dirs, dirs_cap * sizeof (Frecent_Dir *));
+		}
+		Frecent_Dir *dir = (Frecent_Dir *) calloc(1, sizeof (Frecent_Dir));
+		if (dirs == NULL || dir == NULL) {
+			fprintf(stderr, "hush: unable to allocate memory\n");
+			exit(EXIT_FAILURE);
+		}
+		dir->path = entry->key;
+		entry->value = dir;
+		dirs[num_dirs] = dir;
+		index_dir(path, path_len, (uint32_t) num_dirs++);
+	}
+	Frecent_Dir *dir = (Frecent_Dir *) entry->value;
+	dir->rank += rank;
+	if (last_visit > dir->last_visit) {
+		dir->last_visit = last_visit;
+	}
+}
+
+// Lines that don't parse are skipped, and one still being written is left
+// for the next time
+static size_t read_records(char *text, size_t len)
+{
+	size_t used = 0;
+	while (used < len) {
+		char *line = text + used;
+		char *line_end = memchr(line, '\n', len - used);
+		if (line_end == NULL) {
+			break;
+		}
+		used = line_end - text + 1;
+
+		char *cursor = line;
+		double rank = strtod(cursor, &cursor);
+		if (cursor == line || *cursor != ' ') {
+			continue;
+		}
+		char *time_begin = ++cursor;
+		long last_visit = strtol(cursor, &cursor, 10);
+		if (cursor == time_begin || *cursor != ' ' || cursor[1] != '/') {
+			continue;
+		}
+		++cursor;
+		add_record(cursor, line_end - cursor, rank, (time_t) last_visit);
+	}
+	return used;
+}
+
+static void compact_db(void)
+{
+	size_t tmp_path_len = strlen(db_path) + 5;
+	char *tmp_path = (char *) malloc(tmp_path_len * sizeof (char));
+	if (tmp_path == NULL) {
+		fprintf(stderr, "hush: unable to allocate memory\n");
+		exit(EXIT_FAILURE);
+	}
+	snprintf(tmp_path, tmp_path_len, "%s.tmp", db_path);
+	int fd = open_fd(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	FILE *db_file = (fd == -1) ? NULL : fdopen(fd, "w");
+	if (db_file == NULL) {
+		if (fd != -1) {
+			close_fd(fd);
+		}
+		free(tmp_path);
+		return;
+	}
+	size_t num_written = 0;
+	for (size_t i = 0; i < num_dirs; ++i) {
+		if (dirs[i]->rank > 0) {
+			fprintf(db_file, "%.2f %ld %s\n", dirs[i]->rank, (long) dirs[i]->last_visit, dirs[i]->path);
+			++num_written;
+		}
+	}
+	untrack_fd(fd);
+	struct stat info;
+	bool is_written = fflush(db_file) == 0 && fstat(fd, &info) == 0;
+	fclose(db_file);
+	if (is_written && rename(tmp_path, db_path) == 0) {
+		loaded_inode = info.st_ino;
+		loaded_size = info.st_size;
+		num_records = num_written;
+	} else {
+		unlink(tmp_path);
+	}
+	free(tmp_path);
+}
+
+// Reads in whatever was appended since the last lookup, or everything again
+// if another shell compacted the database in the meantime
+static void refresh_db(void)
+{
+	int fd = (db_path == NULL) ? -1 : open_fd(db_path, O_RDONLY, 0);
+	struct stat info;
+	if (fd == -1 || fstat(fd, &info) == -1) {
+		if (fd != -1) {
+			close_fd(fd);
+		}
+		return;
+	}
+	if (info.st_ino != loaded_inode || info.st_size < loaded_size) {
+		for (size_t i = 0; i < num_dirs; ++i) {
+			dirs[i]->rank = 0;
+			dirs[i]->last_visit = 0;
+		}
+		loaded_inode = info.st_ino;
+		loaded_size = 0;
+		num_records = 0;
+	}
+	if (info.st_size > loaded_size) {
+		off_t map_begin = loaded_size - loaded_size % sysconf(_SC_PAGESIZE);
+		size_t map_len = (size_t) (info.st_size - map_begin);
+		char *map = (char *) mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, map_begin);
+		if (map != MAP_FAILED) {
+			size_t skipped = (size_t) (loaded_size - map_begin);
+			loaded_size += (off_t) read_records(map + skipped, map_len - skipped);
+			munmap(map, map_len);
+		}
+	}
+	close_fd(fd);
+	if (num_records > 2 * num_dirs + DB_SLACK) {
+		compact_db();
+	}
+}
+
+void forget_frecent_dir(char *path)
+{
+	Table_Entry *entry = table_find(&db_dirs, path, strlen(path));
+	if (entry != NULL && entry->value != NULL) {
+		((Frecent_Dir *) entry->value)->rank = 0;
+	}
+}
+
+// Frecency is how often a directory is visited, weighted by how recently
+static double get_frecency(Frecent_Dir *dir, time_t now)
+{
+	time_t age = now - dir->last_visit;
+	if (age < 3600) {
+		return dir->rank * 4;
+	} else if (age < 86400) {
+		return dir->rank * 2;
+	} else if (age < 604800) {
+		return dir->rank / 2;
+	}
+	return dir->rank / 4;
+}
+
+static char *find_bytes(char *text, char *text_end, char *pattern, size_t pattern_len, bool is_folded)
+{
+	for (; text + pattern_len <= text_end; ++text) {
+		size_t i = 0;
+		for (; i < pattern_len; ++i) {
+			if (is_folded ? tolower((unsigned char) text[i]) != tolower((unsigned char) pattern[i]) : text[i] != pattern[i]) {
+				break;
+			}
+		}
+		if (i == pattern_len) {
+			return text;
+		}
+	}
+	return NULL;
+}
+
+// The patterns have to match in order, the way 'z foo bar` finds
+// '.../foo/.../bar`
+static bool matches_patterns(char *path, char **patterns, bool is_folded)
+{
+	char *path_end = path + strlen(path);
+	for (; *patterns != NULL; ++patterns) {
+		size_t pattern_len = strlen(*patterns);
+		char *match = find_bytes(path, path_end, *patterns, pattern_len, is_folded);
+		if (match == NULL) {
+			return false;
+		}
+		path = match + pattern_len;
+	}
+	return true;
+}
+
+// Only directories with the rarest run of three bytes from any of the
+// patterns are checked. Matches that get the case right are preferred.
+char *find_frecent_dir(char **patterns)
+{
+	refresh_db();
+	Posting_List *candidates = NULL;
+	for (char **pattern = patterns; *pattern != NULL; ++pattern) {
+		for (size_t i = 0; i + 3 <= strlen(*pattern); ++i) {
+			char key[3] = {tolower((unsigned char) (*pattern)[i]), tolower((unsigned char) (*pattern)[i + 1]), tolower((unsigned char) (*pattern)[i + 2])};
+			Table_Entry *entry = table_find(&trigrams, key, 3);
+			if (entry == NULL || entry->value == NULL) {
+				return NULL;
+			}
+			Posting_List *list = (Posting_List *) entry->value;
+			if (candidates == NULL || list->count < candidates->count) {
+				candidates = list;
+			}
+		}
+	}
+
+	time_t now = time(NULL);
+	Frecent_Dir *best = NULL, *best_folded = NULL;
+	double best_score = 0, best_folded_score = 0;
+	size_t count = (candidates == NULL) ? num_dirs : candidates->count;
+	for (size_t i = 0; i < count; ++i) {
+		Frecent_Dir *dir = dirs[(candidates == NULL) ? i : candidates->ids[i]];
+		if (dir->rank <= 0) {
+			continue;
+		}
+		double score = get_frecency(dir, now);
+		if (score > best_score && matches_patterns(dir->path, patterns, false)) {
+			best = dir;
+			best_score = score;
+		} else if (best == NULL && score > best_folded_score && matches_patterns(dir->path, patterns, true)) {
+			best_folded = dir;
+			best_folded_score = score;
+		}
+	}
+	if (best == NULL) {
+		best = best_folded;
+	}
+	return (best == NULL) ? NULL : best->path;
+}
@@ -0,0 +1,17 @@
+#ifndef DIRS_H_
+#define DIRS_H_
+
+// Returns the directory cd should change to for the name, which has to be
+// freed. It's found through CDPATH unless it's absolute or starts with '.`
+// or '..`, in which case it's just a copy of the name.
+char *find_cd_dir(char *name, bool *is_from_cdpath);
+bool forget_cd_dir(char *name);
+
+// Directories changed to are recorded in the database at the path, or
+// '~/.hush_dirs` if it's NULL. Nothing is read until the first lookup.
+void init_dirs(char *path);
+void visit_dir(char *path);
+char *find_frecent_dir(char **patterns);
+void forget_frecent_dir(char *path);
+
+#endif // DIRS_H_
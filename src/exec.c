@@ -0,0 +1,1434 @@
+#ifdef __linux__
+#define _GNU_SOURCE // memfd_create
+#endif
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "buffer.h"
+#include "lexer.h"
+#include "arena.h"
+#include "parser.h"
+#include "builtin.h"
+#include "exec.h"
+#include "fds.h"
+#include "funcs.h"
+#include "table.h"
+#include "trace.h"
+#include "vars.h"
+
+#define SUBST_DEPTH_CAP 16
+
+int last_status = 0;
+size_t loop_depth = 0;
+size_t break_levels = 0;
+size_t continue_levels = 0;
+size_t function_depth = 0;
+bool return_requested = false;
+bool is_explaining = false;
+
+// '$0`, '$1`, ... for the script or function currently running
+static char **positional_args = NULL;
+
+void set_positional_args(char **args)
+{
+	positional_args = args;
+}
+
+static size_t count_positional_args(void)
+{
+	size_t count = 0;
+	for (; positional_args != NULL && positional_args[count] != NULL; ++count);
+	return count;
+}
+
+typedef struct {
+	char *text;
+	size_t len;
+	size_t cap;
+} String;
+
+static void string_append(String *string, char *text, size_t len)
+{
+	if (string->len + len + 1 > string->cap) {
+		while (string->len + len + 1 > string->cap) {
+			string->cap = (string->cap == 0) ? 64 : 2 * string->cap;
+		}
+		string->text = (char *) realloc(string->text, string->cap * sizeof (char));
+		if (string->text == NULL) {
+			fprintf(stderr, "hush: unable to allocate memory\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	memcpy(string->text + string->len, text, len);
+	string->len += len;
+	string->text[string->len] = '\0';
+}
+
+// Command output is captured into an anonymous file rather than a pipe so the
+// shell never has to interleave reading with waiting. There's one capture per
+// nesting level, each one reused for every substitution at that level.
+typedef struct {
+	int fd;
+	char *text;
+	size_t cap;
+	Arena arena; // What the substituted commands are parsed into
+	Buffer buffer; // Reused so substitutions don't allocate one every time
+} Capture;
+static Capture captures[SUBST_DEPTH_CAP];
+static size_t subst_depth = 0;
+
+static bool init_capture(Capture *capture)
+{
+#ifdef __linux__
+	capture->fd = keep_fd(memfd_create("hush_capture", MFD_CLOEXEC));
+	own_fd(&capture->fd);
+#else
+	FILE *capture_file = tmpfile();
+	capture->fd = (capture_file == NULL) ? -1 : keep_fd(dup(fileno(capture_file)));
+	own_fd(&capture->fd);
+	if (capture_file != NULL) {
+		fclose(capture_file);
+	}
+#endif
+	if (capture->fd == -1) {
+		fprintf(stderr, "hush: unable to create substitution capture file\n");
+		return false;
+	}
+	capture->cap = 4096;
+	capture->text = (char *) malloc(capture->cap * sizeof (char));
+	if (capture->text == NULL) {
+		fprintf(stderr, "hush: unable to allocate memory\n");
+		close_fd(capture->fd);
+		disown_fd(&capture->fd);
+		return false;
+	}
+	return true;
+}
+
+static char *read_capture(Capture *capture)
+{
+	// The capture file holds exactly the output, so it's read with one large read
+	struct stat capture_stat;
+	size_t len = (fstat(capture->fd, &capture_stat) == -1) ? 0 : (size_t) capture_stat.st_size;
+	if (len + 1 > capture->cap) {
+		while (len + 1 > capture->cap) {
+			capture->cap *= 2;
+		}
+		free(capture->text);
+		capture->text = (char *) malloc(capture->cap * sizeof (char));
+		if (capture->text == NULL) {
+			fprintf(stderr, "hush: unable to allocate memory\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	size_t total = 0;
+	while (total < len) {
+		ssize_t count = pread(capture->fd, capture->text + total, len - total, (off_t) total);
+		if (count <= 0) {
+			break;
+		}
+		total += (size_t) count;
+	}
+
+	// Trim trailing newlines in place
+	for (; total > 0 && capture->text[total - 1] == '\n'; --total);
+	capture->text[total] = '\0';
+	return capture->text;
+}
+
+// What every child waited for has used, added up so 'time` can take the
+// difference across whatever it runs. The largest resident set seen is
+// reset by each 'time` instead.
+static struct rusage children_usage;
+
+static void add_timeval(struct timeval *sum, struct timeval value)
+{
+	sum->tv_sec += value.tv_sec;
+	sum->tv_usec += value.tv_usec;
+	if (sum->tv_usec >= 1000000) {
+		++sum->tv_sec;
+		sum->tv_usec -= 1000000;
+	}
+}
+
+static void wait_for_child(pid_t pid, int *status)
+{
+	struct rusage usage;
+	if (wait4(pid, status, 0, &usage) == -1) {
+		return;
+	}
+	add_timeval(&children_usage.ru_utime, usage.ru_utime);
+	add_timeval(&children_usage.ru_stime, usage.ru_stime);
+	children_usage.ru_minflt += usage.ru_minflt;
+	children_usage.ru_majflt += usage.ru_majflt;
+	children_usage.ru_nvcsw += usage.ru_nvcsw;
+	children_usage.ru_nivcsw += usage.ru_nivcsw;
+	if (usage.ru_maxrss > children_usage.ru_maxrss) {
+		children_usage.ru_maxrss = usage.ru_maxrss;
+	}
+}
+
+// Nothing runs if any of it fails to parse
+static Node *parse_nodes(Buffer *buffer, Arena *arena)
+{
+	Node *nodes = NULL, **tail = &nodes;
+	bool is_failed;
+	for (Node *node = get_next_node(&buffer, arena, false, &is_failed); node != NULL; node = get_next_node(&buffer, arena, false, &is_failed)) {
+		*tail = node;
+		for (; node->next != NULL; node = node->next);
+		tail = &node->next;
+	}
+	if (is_failed) {
+		last_status = 2;
+		return NULL;
+	}
+	return nodes;
+}
+
+static Command expand_command(Command command, size_t *num_assigns);
+static void exec_command(Command command, size_t num_assigns, char *path, char **envp);
+
+static char *substitute(char *text, size_t len)
+{
+	if (subst_depth == SUBST_DEPTH_CAP) {
+		fprintf(stderr, "hush: maximum substitution depth exceeded\n");
+		return NULL;
+	}
+	Capture *capture = &captures[subst_depth];
+	if (capture->cap == 0 && !init_capture(capture)) {
+		return NULL;
+	}
+	ftruncate(capture->fd, 0);
+	lseek(capture->fd, 0, SEEK_SET);
+
+	set_buffer(&capture->buffer, text, len);
+	arena_reset(&capture->arena);
+	Node *nodes = parse_nodes(&capture->buffer, &capture->arena);
+
+	// Lists made only of plain builtins can't affect the shell, so skip the subshell
+	bool is_pure = true;
+	for (Node *node = nodes; node != NULL && is_pure; node = node->next) {
+		if (node->type != HUSH_NODE_TYPE_PIPELINE || node->count > 1) {
+			is_pure = false;
+			break;
+		}
+		Command command = node->commands[0];
+		Builtin *builtin = (get_alias(command.name) || get_function(command.name)) ? NULL : get_builtin(command.name);
+		is_pure = builtin != NULL && builtin->is_pure && command.redirects == NULL;
+	}
+
+	fflush(stdout);
+	int saved_stdout = dup_fd(STDOUT_FILENO, 10);
+	dup2(capture->fd, STDOUT_FILENO);
+	++subst_depth;
+	if (is_pure) {
+		run_nodes(nodes);
+	} else {
+		unsigned long long trace_begin = trace_now();
+		char **envp = get_environment();
+		pid_t pid = fork();
+		if (pid == 0) {
+			if (nodes != NULL && nodes->next == NULL && nodes->type == HUSH_NODE_TYPE_PIPELINE && nodes->count == 1 && get_alias(nodes->commands[0].name) == NULL) {
+				size_t num_assigns;
+				Command command = expand_command(nodes->commands[0], &num_assigns);
+				bool is_external = command.name != NULL && get_function(command.name) == NULL && get_builtin(command.name) == NULL;
+				exec_command(command, num_assigns, is_external ? find_executable(command.name) : NULL, envp);
+			}
+			run_nodes(nodes);
+			fflush(stdout);
+			_exit(last_status);
+		}
+		trace_record(HUSH_TRACE_SPAWN, trace_begin, "substitution");
+		trace_begin = trace_now();
+		int status = 0;
+		if (pid != -1) {
+			wait_for_child(pid, &status);
+		}
+		trace_record(HUSH_TRACE_WAIT, trace_begin, "substitution");
+		last_status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+	}
+	--subst_depth;
+	fflush(stdout);
+	dup2(saved_stdout, STDOUT_FILENO);
+	close_fd(saved_stdout);
+
+	return read_capture(capture);
+}
+
+static void append_var(String *result, char **cursor, char *end)
+{
+	char *name = *cursor + 1;
+	size_t name_len = 0;
+	if (*name == '?' || *name == '#') {
+		char number[16];
+		snprintf(number, sizeof (number), "%d", (*name == '?') ? last_status : (int) count_positional_args() - 1);
+		string_append(result, number, strlen(number));
+		*cursor = name + 1;
+		return;
+	}
+	if (*name == '@' || *name == '*') {
+		for (size_t i = 1; i < count_positional_args(); ++i) {
+			if (i > 1) {
+				string_append(result, " ", 1);
+			}
+			string_append(result, positional_args[i], strlen(positional_args[i]));
+		}
+		*cursor = name + 1;
+		return;
+	}
+	if (*name == '{') {
+		char *name_end = memchr(name, '}', end - name);
+		if (name_end == NULL) {
+			string_append(result, *cursor, 1);
+			++*cursor;
+			return;
+		}
+		++name;
+		name_len = name_end - name;
+		*cursor = name_end + 1;
+	} else {
+		if (isdigit(*name)) {
+			name_len = 1;
+		} else if (isalpha(*name) || *name == '_') {
+			for (name_len = 1; isalnum(name[name_len]) || name[name_len] == '_'; ++name_len);
+		}
+		if (name_len == 0) {
+			string_append(result, *cursor, 1);
+			++*cursor;
+			return;
+		}
+		*cursor = name + name_len;
+	}
+	char *value;
+	if (name_len > 0 && isdigit(*name)) {
+		size_t index = (size_t) strtoul(name, (char **) NULL, 10);
+		value = (index < count_positional_args()) ? positional_args[index] : NULL;
+	} else {
+		value = get_var(name, name_len);
+	}
+	if (value != NULL) {
+		string_append(result, value, strlen(value));
+	}
+}
+
+char *expand_word(char *word)
+{
+	char *cursor = strpbrk(word, "$`'\"\\");
+	if (cursor == NULL) {
+		return word;
+	}
+
+	String result = {0};
+	char *end = word + strlen(word);
+	string_append(&result, word, cursor - word);
+	char quote_type = '\0';
+	while (cursor < end) {
+		if (quote_type == '\'') {
+			if (*cursor == '\'') {
+				quote_type = '\0';
+			} else {
+				string_append(&result, cursor, 1);
+			}
+			++cursor;
+			continue;
+		}
+		if (*cursor == '\\' && cursor + 1 < end) {
+
+			// Inside double quotes only a few characters can be escaped
+			if (quote_type == '"' && strchr("$`\"\\", *(cursor + 1)) == NULL) {
+				string_append(&result, cursor, 1);
+			}
+			string_append(&result, cursor + 1, 1);
+			cursor += 2;
+			continue;
+		}
+		if (*cursor == '"') {
+			quote_type = (quote_type == '"') ? '\0' : '"';
+			++cursor;
+			continue;
+		}
+		if (*cursor == '\'' && quote_type == '\0') {
+			quote_type = '\'';
+			++cursor;
+			continue;
+		}
+		bool is_backtick = *cursor == '`';
+		if (is_backtick || (*cursor == '$' && *(cursor + 1) == '(')) {
+			char *subst_end = find_substitution_end(cursor, end);
+			if (subst_end != NULL) {
+				char *subst_begin = cursor + (is_backtick ? 1 : 2);
+				char *output = substitute(subst_begin, subst_end - subst_begin);
+				if (output != NULL) {
+					string_append(&result, output, strlen(output));
+				}
+				cursor = subst_end + 1;
+				continue;
+			}
+		}
+		if (*cursor == '$') {
+			append_var(&result, &cursor, end);
+			continue;
+		}
+		string_append(&result, cursor, 1);
+		++cursor;
+	}
+	return result.text;
+}
+
+// Unquoted words that expand to nothing are dropped from the arguments
+static char **expand_args(char **args)
+{
+	size_t num_args = 0;
+	for (; args[num_args] != NULL; ++num_args);
+	size_t cap = num_args + 1;
+	char **expanded = (char **) calloc(cap, sizeof (char *));
+	size_t num_expanded = 0;
+	for (size_t i = 0; i < num_args; ++i) {
+
+		// '$@` is the only expansion that produces more than one argument
+		if (strcmp(args[i], "$@") == 0 || strcmp(args[i], "\"$@\"") == 0) {
+			size_t num_positional = count_positional_args();
+			for (size_t j = 1; j < num_positional; ++j) {
+				if (num_expanded + (num_args - i) + 1 > cap) {
+					cap *= 2;
+					expanded = (char **) realloc(expanded, cap * sizeof (char *));
+				}
+				expanded[num_expanded++] = strdup(positional_args[j]);
+			}
+			continue;
+		}
+		char *word = expand_word(args[i]);
+		if (*word == '\0' && strpbrk(args[i], "'\"") == NULL) {
+			if (word != args[i]) {
+				free(word);
+			}
+			continue;
+		}
+
+		// Unquoted patterns become the files they match, or stay as they are
+		// when nothing does
+		glob_t matches;
+		if (strpbrk(args[i], "*?[") != NULL && strpbrk(args[i], "'\"\\") == NULL && glob(word, GLOB_NOCHECK, NULL, &matches) == 0) {
+			while (num_expanded + matches.gl_pathc + (num_args - i) > cap) {
+				cap *= 2;
+			}
+			expanded = (char **) realloc(expanded, cap * sizeof (char *));
+			for (size_t j = 0; j < matches.gl_pathc; ++j) {
+				expanded[num_expanded++] = strdup(matches.gl_pathv[j]);
+			}
+			globfree(&matches);
+			if (word != args[i]) {
+				free(word);
+			}
+			continue;
+		}
+		expanded[num_expanded++] = word;
+	}
+	expanded[num_expanded] = NULL;
+	return expanded;
+}
+
+static void free_expanded_args(char **expanded, char **args)
+{
+	for (size_t i = 0; expanded[i] != NULL; ++i) {
+		bool is_original = false;
+		for (size_t j = 0; args[j] != NULL && !is_original; ++j) {
+			is_original = expanded[i] == args[j];
+		}
+		if (!is_original) {
+			free(expanded[i]);
+		}
+	}
+	free(expanded);
+}
+
+// The name of the expanded command is the first word after any assignments,
+// or NULL if the command only sets variables
+static Command expand_command(Command command, size_t *num_assigns)
+{
+	for (*num_assigns = 0; command.args[*num_assigns] != NULL; ++*num_assigns) {
+		if (get_assignment_name_len(command.args[*num_assigns]) == 0) {
+			break;
+		}
+	}
+	Command expanded = command;
+	expanded.args = expand_args(command.args);
+	expanded.name = expanded.args[*num_assigns];
+	return expanded;
+}
+
+static void apply_assignments(char **args, size_t num_assigns, bool should_export)
+{
+	for (size_t i = 0; i < num_assigns; ++i) {
+		size_t name_len = get_assignment_name_len(args[i]);
+		set_var(args[i], name_len, args[i] + name_len + 1);
+		if (should_export) {
+			export_var(args[i], name_len);
+		}
+	}
+}
+
+static char *search_path(char *name)
+{
+	if (strchr(name, '/') != NULL) {
+		return strdup(name);
+	}
+	char *path_var = get_var("PATH", 4);
+	if (path_var == NULL) {
+		path_var = "/usr/local/bin:/usr/bin:/bin";
+	}
+	size_t name_len = strlen(name);
+	for (char *dir = path_var, *dir_end; *dir != '\0'; dir = (*dir_end == ':') ? dir_end + 1 : dir_end) {
+		dir_end = strchr(dir, ':');
+		if (dir_end == NULL) {
+			dir_end = dir + strlen(dir);
+		}
+		size_t dir_len = dir_end - dir;
+		if (dir_len == 0) {
+			continue;
+		}
+		char *candidate = (char *) malloc((dir_len + name_len + 2) * sizeof (char));
+		memcpy(candidate, dir, dir_len);
+		candidate[dir_len] = '/';
+		memcpy(candidate + dir_len + 1, name, name_len + 1);
+		struct stat candidate_stat;
+		if (stat(candidate, &candidate_stat) == 0 && S_ISREG(candidate_stat.st_mode) && access(candidate, X_OK) == 0) {
+			return candidate;
+		}
+		free(candidate);
+	}
+	return NULL;
+}
+
+// Resolved commands are remembered until PATH changes. This is done in the
+// parent so that the cache outlives the children it's resolved for.
+static Table path_cache;
+static unsigned long path_cache_version = 0;
+
+char *find_executable(char *name)
+{
+	if (strchr(name, '/') != NULL) {
+		return name;
+	}
+	if (path_cache_version != path_version) {
+		for (size_t i = 0; i < path_cache.cap; ++i) {
+			free(path_cache.entries[i].value);
+			path_cache.entries[i].value = NULL;
+		}
+		path_cache_version = path_version;
+	}
+	size_t name_len = strlen(name);
+	Table_Entry *entry = table_find(&path_cache, name, name_len);
+	if (entry != NULL && entry->value != NULL) {
+		return (char *) entry->value;
+	}
+	char *path = search_path(name);
+	if (path != NULL) {
+		table_insert(&path_cache, name, name_len)->value = path;
+	}
+	return path;
+}
+
+static int get_file_redirect_open_flags(int mode)
+{
+	switch (mode) {
+		case O_WRONLY: return O_WRONLY | O_CREAT | O_TRUNC;
+		case O_RDWR: return O_RDWR | O_CREAT;
+		case O_APPEND: return O_WRONLY | O_CREAT | O_APPEND;
+		default: return mode;
+	}
+}
+
+static int open_anonymous_file(char *name)
+{
+	int fd = -1;
+#ifdef __linux__
+	fd = memfd_create(name, MFD_CLOEXEC);
+#else
+	(void) name;
+	FILE *file = tmpfile();
+	fd = (file == NULL) ? -1 : dup(fileno(file));
+	if (file != NULL) {
+		fclose(file);
+	}
+#endif
+	return (fd == -1) ? -1 : track_fd(fd);
+}
+
+// Bodies that fit in a pipe are written straight into one, anything larger
+// goes into an anonymous in-memory file so nothing ever touches the disk
+static int open_here_document(char *body, size_t len)
+{
+	if (len <= PIPE_BUF) {
+		int pipe_fds[2];
+		if (!open_pipe(pipe_fds)) {
+			return -1;
+		}
+		write(pipe_fds[1], body, len);
+		close_fd(pipe_fds[1]);
+		return pipe_fds[0];
+	}
+	int fd = open_anonymous_file("hush_here_document");
+	if (fd == -1) {
+		return -1;
+	}
+	for (size_t total = 0; total < len;) {
+		ssize_t count = write(fd, body + total, len - total);
+		if (count <= 0) {
+			close_fd(fd);
+			return -1;
+		}
+		total += (size_t) count;
+	}
+	lseek(fd, 0, SEEK_SET);
+	return fd;
+}
+
+
+static int open_redirect(File_Redirect redirect)
+{
+	if (redirect.here_document != NULL) {
+		if (!redirect.is_here_string) {
+			return open_here_document(redirect.here_document, redirect.here_document_len);
+		}
+		String body = {0};
+		char *word = expand_word(redirect.here_document);
+		string_append(&body, word, strlen(word));
+		string_append(&body, "\n", 1);
+		if (word != redirect.here_document) {
+			free(word);
+		}
+		int fd = open_here_document(body.text, body.len);
+		free(body.text);
+		return fd;
+	}
+	if (redirect.word == NULL) {
+		return redirect.output_fd;
+	}
+	char *path = expand_word(redirect.word);
+	int fd = open_fd(path, get_file_redirect_open_flags(redirect.mode), 0644);
+	if (fd == -1) {
+		fprintf(stderr, "hush: file '%s` cannot be opened\n", path);
+	}
+	if (path != redirect.word) {
+		free(path);
+	}
+	return fd;
+}
+
+// What a redirect in the shell itself replaced, which is put back after it
+typedef struct {
+	int fd; // -2 if the redirect was never applied, -1 if nothing was there
+	bool is_lent; // One of the shell's own descriptors
+} Saved_Fd;
+
+static bool apply_redirects(File_Redirect *redirects, Saved_Fd *saved_fds)
+{
+	if (redirects == NULL) {
+		return true;
+	}
+	for (size_t i = 0; !fr_equals_zero(redirects[i]); ++i) {
+		if (saved_fds != NULL) {
+			saved_fds[i].is_lent = lend_fd(redirects[i].input_fd);
+			saved_fds[i].fd = dup_fd(redirects[i].input_fd, 10);
+		}
+		int fd = open_redirect(redirects[i]);
+		if (fd == -1) {
+			return false;
+		}
+		if (fd != redirects[i].input_fd) {
+			dup2(fd, redirects[i].input_fd);
+			if (fd != redirects[i].output_fd) {
+				close_fd(fd);
+			}
+		} else {
+			fcntl(fd, F_SETFD, 0);
+		}
+
+		// The target belongs to the command now, even if it was opened
+		// straight onto it
+		untrack_fd(redirects[i].input_fd);
+	}
+	return true;
+}
+
+static void restore_redirects(File_Redirect *redirects, Saved_Fd *saved_fds)
+{
+	if (redirects == NULL) {
+		return;
+	}
+	size_t num_frs = 0;
+	for (; !fr_equals_zero(redirects[num_frs]); ++num_frs);
+	while (num_frs-- > 0) {
+		Saved_Fd saved = saved_fds[num_frs];
+		int fd = redirects[num_frs].input_fd;
+		if (saved.fd == -2) {
+			continue;
+		}
+		if (saved.is_lent) {
+			give_back_fd(saved.fd, fd);
+		} else if (saved.fd == -1) {
+			close(fd);
+		} else {
+			dup2(saved.fd, fd);
+			close_fd(saved.fd);
+		}
+	}
+}
+
+// Loops inside a function can't be broken out of from outside it
+static int run_function(Node *function, char **args)
+{
+	char **saved_args = positional_args;
+	size_t saved_loop_depth = loop_depth;
+	positional_args = args;
+	loop_depth = 0;
+	++function_depth;
+	int status = run_nodes(function);
+	return_requested = false;
+	--function_depth;
+	loop_depth = saved_loop_depth;
+	positional_args = saved_args;
+	return status;
+}
+
+static int run_compound(Node *node);
+
+// Runs a builtin, a function or a compound command in the shell process
+// itself, only one of which is given
+static int run_in_process(File_Redirect *redirects, char **args, Builtin *builtin, Node *function, Node *compound)
+{
+	size_t num_frs = 0;
+	for (; redirects != NULL && !fr_equals_zero(redirects[num_frs]); ++num_frs);
+	Saved_Fd *saved_fds = (num_frs > 0) ? (Saved_Fd *) malloc(num_frs * sizeof (Saved_Fd)) : NULL;
+
+	for (size_t i = 0; i < num_frs; ++i) {
+		saved_fds[i] = (Saved_Fd) {-2, false};
+	}
+
+	fflush(stdout);
+	int status = 1;
+	if (apply_redirects(redirects, saved_fds)) {
+		if (compound != NULL) {
+			status = run_compound(compound);
+		} else {
+			status = (function != NULL) ? run_function(function, args) : builtin->func(args);
+		}
+	}
+	fflush(stdout);
+	restore_redirects(redirects, saved_fds);
+	free(saved_fds);
+	return status;
+}
+
+// The environment the parent built is shared by every command it spawns, so
+// a command's own assignments are only put on top of it in the child
+static char **layer_assignments(char **envp, char **assigns, size_t num_assigns)
+{
+	if (num_assigns == 0) {
+		return envp;
+	}
+	size_t envc = 0;
+	for (; envp[envc] != NULL; ++envc);
+	char **layered = (char **) malloc((envc + num_assigns + 1) * sizeof (char *));
+	if (layered == NULL) {
+		fprintf(stderr, "hush: unable to allocate memory\n");
+		_exit(EXIT_FAILURE);
+	}
+	size_t count = 0;
+	for (size_t i = 0; i < envc; ++i) {
+		bool is_assigned = false;
+		for (size_t j = 0; j < num_assigns && !is_assigned; ++j) {
+			size_t name_len = get_assignment_name_len(assigns[j]);
+			is_assigned = strncmp(envp[i], assigns[j], name_len + 1) == 0;
+		}
+		if (!is_assigned) {
+			layered[count++] = envp[i];
+		}
+	}
+	for (size_t j = 0; j < num_assigns; ++j) {
+		size_t name_len = get_assignment_name_len(assigns[j]);
+		bool is_overridden = false;
+		for (size_t k = j + 1; k < num_assigns && !is_overridden; ++k) {
+			is_overridden = strncmp(assigns[k], assigns[j], name_len + 1) == 0;
+		}
+		if (!is_overridden) {
+			layered[count++] = assigns[j];
+		}
+	}
+	layered[count] = NULL;
+	return layered;
+}
+
+// Only ever called in a child process, with the environment built before the fork
+static void exec_command(Command command, size_t num_assigns, char *path, char **envp)
+{
+	signal(SIGINT, SIG_DFL);
+	signal(SIGQUIT, SIG_DFL);
+	if (!apply_redirects(command.redirects, NULL)) {
+		_exit(1);
+	}
+	envp = layer_assignments(envp, command.args, num_assigns);
+	apply_assignments(command.args, num_assigns, true);
+	if (command.name == NULL) {
+		_exit(0);
+	}
+	char **args = command.args + num_assigns;
+
+	Node *function = get_function(command.name);
+	if (function != NULL) {
+		int status = run_function(function, args);
+		fflush(stdout);
+		_exit(status);
+	}
+	Builtin *builtin = get_builtin(command.name);
+	if (builtin != NULL) {
+		int status = builtin->func(args);
+		fflush(stdout);
+		_exit(status);
+	}
+	if (path != NULL) {
+		execve(path, args, envp);
+	}
+
+	// The cached path may have gone stale since it was resolved
+	if (path == NULL || errno == ENOENT) {
+		path = search_path(command.name);
+		if (path != NULL) {
+			execve(path, args, envp);
+		}
+	}
+	if (path == NULL || errno == ENOENT) {
+		fprintf(stderr, "hush: command not found: %s\n", command.name);
+		_exit(127);
+	}
+	fprintf(stderr, "hush: unable to execute '%s`\n", command.name);
+	_exit(126);
+}
+
+typedef enum {
+	HUSH_STAGE_SPAWN,
+	HUSH_STAGE_INPUT_FILE, // 'cat file | ...` is read as '< file ...`
+	HUSH_STAGE_DROP, // A bare 'cat` between two other stages
+	HUSH_STAGE_IN_SHELL, // A pure builtin at either end runs without a fork
+} Hush_Stage_Plan;
+
+// Stages are only rewritten once they're expanded, so what's planned is what
+// would have run. Functions and aliases named cat are never touched.
+static Hush_Stage_Plan plan_stage(Command command, size_t num_assigns, Builtin *builtin, bool is_external, size_t i, size_t count)
+{
+	if (count == 1 || command.name == NULL || num_assigns > 0 || command.redirects != NULL) {
+		return HUSH_STAGE_SPAWN;
+	}
+	char **args = command.args;
+	if (is_external && strcmp(command.name, "cat") == 0) {
+		if (i == 0 && args[1] != NULL && args[1][0] != '-' && args[2] == NULL) {
+			return HUSH_STAGE_INPUT_FILE;
+		}
+		if (i > 0 && i + 1 < count && args[1] == NULL) {
+			return HUSH_STAGE_DROP;
+		}
+	}
+	if (builtin != NULL && builtin->is_pure && (i == 0 || i + 1 == count)) {
+		return HUSH_STAGE_IN_SHELL;
+	}
+	return HUSH_STAGE_SPAWN;
+}
+
+// Only regular files are read straight from, so cat still gets to complain
+// about anything else
+static int open_input_file(char *path)
+{
+	int fd = open_fd(path, O_RDONLY, 0);
+	struct stat info;
+	if (fd != -1 && (fstat(fd, &info) == -1 || !S_ISREG(info.st_mode))) {
+		close_fd(fd);
+		fd = -1;
+	}
+	return fd;
+}
+
+// A builtin at the start writes into an anonymous file that the next stage
+// reads like a redirect. One at the end has nothing to read, so its input is
+// closed like it would be by the builtin exiting.
+static int run_stage_in_shell(Command command, Builtin *builtin, int *input_fd, bool is_first)
+{
+	if (!is_first) {
+		if (*input_fd != STDIN_FILENO) {
+			close_fd(*input_fd);
+		}
+		*input_fd = -1;
+		int status = builtin->func(command.args);
+		fflush(stdout);
+		return status;
+	}
+	int fd = open_anonymous_file("hush_pipeline");
+	int saved_stdout = (fd == -1) ? -1 : dup_fd(STDOUT_FILENO, 10);
+	if (saved_stdout == -1) {
+		if (fd != -1) {
+			close_fd(fd);
+		}
+		return -1;
+	}
+	fflush(stdout);
+	dup2(fd, STDOUT_FILENO);
+	int status = builtin->func(command.args);
+	fflush(stdout);
+	dup2(saved_stdout, STDOUT_FILENO);
+	close_fd(saved_stdout);
+	lseek(fd, 0, SEEK_SET);
+	*input_fd = fd;
+	return status;
+}
+
+static void explain_stage(String *plan, Command command, bool is_piped, char *note)
+{
+	if (plan->len > 0) {
+		string_append(plan, is_piped ? " | " : " ", is_piped ? 3 : 1);
+	}
+	for (size_t i = 0; command.args[i] != NULL; ++i) {
+		if (i > 0) {
+			string_append(plan, " ", 1);
+		}
+		string_append(plan, command.args[i], strlen(command.args[i]));
+	}
+
+	// Redirects are shown as written, with the descriptor only when it isn't
+	// the one the operator would use anyway
+	for (size_t i = 0; command.redirects != NULL && !fr_equals_zero(command.redirects[i]); ++i) {
+		File_Redirect redirect = command.redirects[i];
+		char *operator = ">";
+		int default_fd = STDOUT_FILENO;
+		if (redirect.here_document != NULL) {
+			operator = redirect.is_here_string ? "<<<" : "<<";
+			default_fd = STDIN_FILENO;
+		} else if (redirect.mode == O_RDONLY || redirect.mode == O_RDWR) {
+			operator = (redirect.mode == O_RDONLY) ? "<" : "<>";
+			default_fd = STDIN_FILENO;
+		} else if (redirect.mode == O_APPEND) {
+			operator = ">>";
+		}
+		char text[32];
+		int len = (redirect.input_fd == default_fd) ? 0 : snprintf(text, sizeof (text), "%d", redirect.input_fd);
+		string_append(plan, " ", 1);
+		string_append(plan, text, (size_t) len);
+		string_append(plan, operator, strlen(operator));
+		if (redirect.here_document != NULL && redirect.is_here_string) {
+			string_append(plan, redirect.here_document, redirect.here_document_len);
+		} else if (redirect.here_document != NULL) {
+			string_append(plan, "(here-document)", 15);
+		} else if (redirect.word == NULL) {
+			len = snprintf(text, sizeof (text), "&%d", redirect.output_fd);
+			string_append(plan, text, (size_t) len);
+		} else {
+			string_append(plan, redirect.word, strlen(redirect.word));
+		}
+	}
+	if (note != NULL) {
+		string_append(plan, note, strlen(note));
+	}
+}
+
+// A stage of a pipeline once it's been expanded and planned
+typedef struct {
+	Command command;
+	size_t num_assigns;
+	Node *function;
+	Builtin *builtin;
+	bool is_external;
+	Hush_Stage_Plan plan;
+} Stage;
+
+static int run_pipeline(Command *commands, size_t count)
+{
+	pid_t *pids = (pid_t *) malloc(count * sizeof (pid_t));
+	Stage *stages = (Stage *) malloc(count * sizeof (Stage));
+	if (pids == NULL || stages == NULL) {
+		fprintf(stderr, "hush: unable to allocate memory\n");
+		exit(EXIT_FAILURE);
+	}
+	int input_fd = STDIN_FILENO;
+	int in_shell_status = -1; // Set when the last stage ran in the shell
+
+	// Every stage is planned before any of them runs, so an explained plan
+	// comes out ahead of anything the pipeline prints. Trivial stages are
+	// rewritten instead of spawned, falling back to spawning them whenever a
+	// rewrite doesn't work out.
+	String plan = {0};
+	bool is_piped = true;
+	for (size_t i = 0; i < count; ++i) {
+		Stage *stage = &stages[i];
+		stage->command = expand_command(commands[i], &stage->num_assigns);
+		Command command = stage->command;
+		stage->function = (command.name == NULL) ? NULL : get_function(command.name);
+		stage->builtin = (command.name == NULL || stage->function != NULL) ? NULL : get_builtin(command.name);
+		stage->is_external = command.name != NULL && stage->function == NULL && stage->builtin == NULL;
+		stage->plan = plan_stage(command, stage->num_assigns, stage->builtin, stage->is_external, i, count);
+		if (stage->plan == HUSH_STAGE_INPUT_FILE && (input_fd = open_input_file(command.args[1])) == -1) {
+			input_fd = STDIN_FILENO;
+			stage->plan = HUSH_STAGE_SPAWN;
+		}
+		if (!is_explaining || stage->plan == HUSH_STAGE_DROP) {
+			continue;
+		}
+		if (stage->plan == HUSH_STAGE_INPUT_FILE) {
+			string_append(&plan, "< ", 2);
+			string_append(&plan, command.args[1], strlen(command.args[1]));
+			is_piped = false;
+			continue;
+		}
+		explain_stage(&plan, command, is_piped, (stage->plan == HUSH_STAGE_IN_SHELL) ? " (in shell)" : NULL);
+		is_piped = true;
+	}
+	if (is_explaining) {
+		fprintf(stderr, "hush: plan: %s\n", (plan.text == NULL) ? "" : plan.text);
+		free(plan.text);
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		Command command = stages[i].command;
+		size_t num_assigns = stages[i].num_assigns;
+		Builtin *builtin = stages[i].builtin;
+		bool is_external = stages[i].is_external;
+		Hush_Stage_Plan stage_plan = stages[i].plan;
+		if (stage_plan == HUSH_STAGE_IN_SHELL) {
+			int status = run_stage_in_shell(command, builtin, &input_fd, i == 0);
+			if (status == -1) {
+				stage_plan = HUSH_STAGE_SPAWN;
+				if (is_explaining) {
+					fprintf(stderr, "hush: plan: '%s` spawned after all\n", command.name);
+				}
+			} else if (i + 1 == count) {
+				in_shell_status = status;
+			}
+		}
+		if (stage_plan != HUSH_STAGE_SPAWN) {
+			pids[i] = -1;
+			free_expanded_args(command.args, commands[i].args);
+			continue;
+		}
+
+		// Lone builtins, functions and assignments have to run in the shell itself
+		if (count == 1 && !is_external) {
+			int status = 0;
+			apply_assignments(command.args, num_assigns, false);
+			if (command.name != NULL) {
+				status = run_in_process(command.redirects, command.args + num_assigns, builtin, stages[i].function, NULL);
+			}
+			free_expanded_args(command.args, commands[i].args);
+			free(stages);
+			free(pids);
+			return status;
+		}
+		char *path = NULL;
+		unsigned long long trace_begin = trace_now();
+		if (is_external) {
+			path = find_executable(command.name);
+			trace_record(HUSH_TRACE_RESOLVE, trace_begin, command.name);
+		}
+
+		trace_begin = trace_now();
+		int pipe_fds[2] = {-1, -1};
+		if (i + 1 < count && !open_pipe(pipe_fds)) {
+			fprintf(stderr, "hush: unable to create pipe\n");
+		}
+		fflush(stdout);
+		char **envp = get_environment();
+		if ((pids[i] = fork()) == 0) {
+			if (input_fd != STDIN_FILENO) {
+				dup2(input_fd, STDIN_FILENO);
+				close_fd(input_fd);
+			}
+			if (pipe_fds[1] != -1) {
+				dup2(pipe_fds[1], STDOUT_FILENO);
+				close_fd(pipe_fds[0]);
+				close_fd(pipe_fds[1]);
+			}
+			exec_command(command, num_assigns, path, envp);
+		}
+		trace_record(HUSH_TRACE_SPAWN, trace_begin, command.name);
+		if (pids[i] == -1) {
+			fprintf(stderr, "hush: unable to fork '%s`\n", command.name);
+		}
+		free_expanded_args(command.args, commands[i].args);
+
+		if (input_fd != STDIN_FILENO) {
+			close_fd(input_fd);
+		}
+		if (pipe_fds[1] != -1) {
+			close_fd(pipe_fds[1]);
+		}
+		input_fd = pipe_fds[0];
+	}
+
+	free(stages);
+
+	unsigned long long trace_begin = trace_now();
+	int status = 0;
+	for (size_t i = 0; i < count; ++i) {
+		if (pids[i] != -1) {
+			wait_for_child(pids[i], &status);
+		}
+	}
+	trace_record(HUSH_TRACE_WAIT, trace_begin, commands[0].name);
+	free(pids);
+	if (in_shell_status != -1) {
+		return in_shell_status;
+	}
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+static Command *append_command(Command *commands, size_t *count, size_t *cap, Command command)
+{
+	if (*count == *cap) {
+		*cap = (*cap == 0) ? 4 : 2 * *cap;
+		commands = (Command *) realloc(commands, *cap * sizeof (Command));
+		if (commands == NULL) {
+			fprintf(stderr, "hush: unable to allocate memory\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	commands[(*count)++] = command;
+	return commands;
+}
+
+static char **concat_args(char **first, char **second)
+{
+	size_t first_len = 0, second_len = 0;
+	for (; first[first_len] != NULL; ++first_len);
+	for (; second[second_len] != NULL; ++second_len);
+	char **args = (char **) calloc(first_len + second_len + 1, sizeof (char *));
+	memcpy(args, first, first_len * sizeof (char *));
+	memcpy(args + first_len, second, second_len * sizeof (char *));
+	return args;
+}
+
+static File_Redirect *concat_redirects(File_Redirect *first, File_Redirect *second)
+{
+	size_t first_len = 0, second_len = 0;
+	for (; !fr_equals_zero(first[first_len]); ++first_len);
+	for (; !fr_equals_zero(second[second_len]); ++second_len);
+	File_Redirect *redirects = (File_Redirect *) calloc(first_len + second_len + 1, sizeof (File_Redirect));
+	memcpy(redirects, first, first_len * sizeof (File_Redirect));
+	memcpy(redirects + first_len, second, second_len * sizeof (File_Redirect));
+	return redirects;
+}
+
+// Splices in the already parsed commands of any aliases, the last one picking
+// up the arguments, redirects and pipe of the command that used the alias.
+// Returns NULL when there's nothing to replace, otherwise whatever had to be
+// allocated is kept in allocations to be freed once the commands have run.
+static Command *expand_aliases(Command *commands, size_t *count, void **allocations, size_t *num_allocations)
+{
+	size_t first_alias = 0;
+	for (; first_alias < *count && get_alias(commands[first_alias].name) == NULL; ++first_alias);
+	if (first_alias == *count) {
+		return NULL;
+	}
+
+	Command *expanded = NULL;
+	size_t num_expanded = 0, cap = 0;
+	for (size_t i = 0; i < *count; ++i) {
+		Command_List *alias = (i < first_alias) ? NULL : get_alias(commands[i].name);
+		if (alias == NULL) {
+			expanded = append_command(expanded, &num_expanded, &cap, commands[i]);
+			continue;
+		}
+		for (size_t j = 0; j + 1 < alias->count; ++j) {
+			expanded = append_command(expanded, &num_expanded, &cap, alias->commands[j]);
+		}
+		Command last = alias->commands[alias->count - 1];
+		last.args = concat_args(last.args, commands[i].args + 1);
+		last.name = last.args[0];
+		allocations[(*num_allocations)++] = last.args;
+		if (last.redirects == NULL) {
+			last.redirects = commands[i].redirects;
+		} else if (commands[i].redirects != NULL) {
+			last.redirects = concat_redirects(last.redirects, commands[i].redirects);
+			allocations[(*num_allocations)++] = last.redirects;
+		}
+		last.has_pipe = commands[i].has_pipe;
+		last.connector = commands[i].connector;
+		expanded = append_command(expanded, &num_expanded, &cap, last);
+	}
+	*count = num_expanded;
+	return expanded;
+}
+
+// Whether anything still has to run or the commands are being left early by
+// exit, break, continue or return
+static bool is_unwinding(void)
+{
+	return exit_requested || break_levels > 0 || continue_levels > 0 || return_requested;
+}
+
+static bool should_skip(Hush_Connector connector)
+{
+	return (connector == HUSH_CONNECTOR_AND && last_status != 0) || (connector == HUSH_CONNECTOR_OR && last_status == 0);
+}
+
+// How many run_commands() calls are running, aliases removed by any of them
+// are only freed once they're all done
+static size_t commands_depth = 0;
+
+int run_commands(Command *commands, size_t count)
+{
+	++commands_depth;
+	void **allocations = (void **) malloc(2 * count * sizeof (void *));
+	size_t num_allocations = 0;
+	Command *expanded = expand_aliases(commands, &count, allocations, &num_allocations);
+	Command *current = (expanded == NULL) ? commands : expanded;
+
+	size_t begin = 0;
+	Hush_Connector connector = HUSH_CONNECTOR_NONE;
+	for (size_t i = 0; i < count && !is_unwinding(); ++i) {
+		if (current[i].has_pipe && i + 1 < count) {
+			continue;
+		}
+		if (!should_skip(connector)) {
+			last_status = run_pipeline(&current[begin], i - begin + 1);
+		}
+		connector = current[i].connector;
+		begin = i + 1;
+	}
+
+	for (size_t i = 0; i < num_allocations; ++i) {
+		free(allocations[i]);
+	}
+	free(allocations);
+	free(expanded);
+	if (--commands_depth == 0) {
+		free_retired_aliases();
+	}
+	return last_status;
+}
+
+// Uses up this loop's share of a break or continue, returning whether the
+// loop should stop
+static bool should_stop_loop(void)
+{
+	if (break_levels > 0) {
+		--break_levels;
+		return true;
+	}
+	if (continue_levels > 1) {
+		--continue_levels;
+		return true;
+	}
+	continue_levels = 0;
+	return exit_requested || return_requested;
+}
+
+static int run_loop(Node *node)
+{
+	int status = 0;
+	++loop_depth;
+	while (true) {
+		run_nodes(node->condition);
+		if (is_unwinding()) {
+			if (should_stop_loop()) {
+				break;
+			}
+			continue;
+		}
+		if ((last_status == 0) == (node->type == HUSH_NODE_TYPE_UNTIL)) {
+			break;
+		}
+		status = run_nodes(node->body);
+		if (should_stop_loop()) {
+			break;
+		}
+	}
+	--loop_depth;
+	return status;
+}
+
+// The words are expanded once before the first iteration
+static int run_for(Node *node)
+{
+	static char *no_words[] = {NULL};
+	char **expanded = (node->words == NULL) ? NULL : expand_args(node->words);
+	char **words = expanded;
+	if (words == NULL) {
+		words = (count_positional_args() > 1) ? positional_args + 1 : no_words;
+	}
+
+	int status = 0;
+	size_t name_len = strlen(node->name);
+	++loop_depth;
+	for (size_t i = 0; words[i] != NULL; ++i) {
+		set_var(node->name, name_len, words[i]);
+		status = run_nodes(node->body);
+		if (should_stop_loop()) {
+			break;
+		}
+	}
+	--loop_depth;
+	if (expanded != NULL) {
+		free_expanded_args(expanded, node->words);
+	}
+	return status;
+}
+
+static int run_compound(Node *node)
+{
+	switch (node->type) {
+		case HUSH_NODE_TYPE_IF: {
+			run_nodes(node->condition);
+			if (is_unwinding()) {
+				return last_status;
+			}
+			if (last_status == 0) {
+				return run_nodes(node->body);
+			}
+			return (node->else_body == NULL) ? 0 : run_nodes(node->else_body);
+		}
+		case HUSH_NODE_TYPE_WHILE:
+		case HUSH_NODE_TYPE_UNTIL: {
+			return run_loop(node);
+		}
+		case HUSH_NODE_TYPE_FOR: {
+			return run_for(node);
+		}
+		case HUSH_NODE_TYPE_GROUP: {
+			return run_nodes(node->body);
+		}
+		case HUSH_NODE_TYPE_FUNCTION: {
+			define_function(node->name, strlen(node->name), node->body);
+			return 0;
+		}
+		default: {
+			return last_status;
+		}
+	}
+}
+
+typedef struct {
+	struct timespec real;
+	struct rusage self;
+	struct rusage children;
+} Usage_Snapshot;
+
+static void take_snapshot(Usage_Snapshot *snapshot)
+{
+	clock_gettime(CLOCK_MONOTONIC, &snapshot->real);
+	getrusage(RUSAGE_SELF, &snapshot->self);
+	snapshot->children = children_usage;
+}
+
+static double get_seconds(struct timeval time)
+{
+	return time.tv_sec + time.tv_usec / 1e6;
+}
+
+static void print_seconds(char *name, double seconds)
+{
+	fprintf(stderr, "%s\t%dm%.3fs\n", name, (int) (seconds / 60), seconds - 60 * (int) (seconds / 60));
+}
+
+// Both the shell itself and its children count, since builtins and
+// functions run in the shell
+static void print_usage(Usage_Snapshot *begin, long max_rss)
+{
+	Usage_Snapshot end;
+	take_snapshot(&end);
+	double real = (end.real.tv_sec - begin->real.tv_sec) + (end.real.tv_nsec - begin->real.tv_nsec) / 1e9;
+	double user = get_seconds(end.self.ru_utime) - get_seconds(begin->self.ru_utime) + get_seconds(end.children.ru_utime) - get_seconds(begin->children.ru_utime);
+	double sys = get_seconds(end.self.ru_stime) - get_seconds(begin->self.ru_stime) + get_seconds(end.children.ru_stime) - get_seconds(begin->children.ru_stime);
+	long minor_faults = (end.self.ru_minflt - begin->self.ru_minflt) + (end.children.ru_minflt - begin->children.ru_minflt);
+	long major_faults = (end.self.ru_majflt - begin->self.ru_majflt) + (end.children.ru_majflt - begin->children.ru_majflt);
+	long voluntary = (end.self.ru_nvcsw - begin->self.ru_nvcsw) + (end.children.ru_nvcsw - begin->children.ru_nvcsw);
+	long involuntary = (end.self.ru_nivcsw - begin->self.ru_nivcsw) + (end.children.ru_nivcsw - begin->children.ru_nivcsw);
+
+	// Nothing was forked, so the shell itself is all that ran
+	if (max_rss == 0) {
+		max_rss = end.self.ru_maxrss;
+	}
+#ifdef __APPLE__
+	max_rss /= 1024; // Bytes rather than kilobytes
+#endif
+
+	fprintf(stderr, "\n");
+	print_seconds("real", real);
+	print_seconds("user", user);
+	print_seconds("sys", sys);
+	fprintf(stderr, "maxrss\t%ldKB\n", max_rss);
+	fprintf(stderr, "faults\t%ld minor, %ld major\n", minor_faults, major_faults);
+	fprintf(stderr, "csw\t%ld voluntary, %ld involuntary\n", voluntary, involuntary);
+}
+
+static int run_untimed(Node *node)
+{
+	if (node->type == HUSH_NODE_TYPE_PIPELINE) {
+		return run_commands(node->commands, node->count);
+	}
+	if (node->redirects == NULL) {
+		return run_compound(node);
+	}
+	return run_in_process(node->redirects, NULL, NULL, NULL, node);
+}
+
+static int run_timed(Node *node)
+{
+	long saved_max_rss = children_usage.ru_maxrss;
+	children_usage.ru_maxrss = 0;
+	Usage_Snapshot begin;
+	take_snapshot(&begin);
+	int status = run_untimed(node);
+	print_usage(&begin, children_usage.ru_maxrss);
+	if (saved_max_rss > children_usage.ru_maxrss) {
+		children_usage.ru_maxrss = saved_max_rss;
+	}
+	return status;
+}
+
+// Runs a list of nodes, each one only if the connector before it allows
+int run_nodes(Node *node)
+{
+	Hush_Connector connector = HUSH_CONNECTOR_NONE;
+	for (; node != NULL && !is_unwinding(); node = node->next) {
+		bool is_skipped = should_skip(connector);
+		connector = node->connector;
+		if (is_skipped) {
+			continue;
+		}
+		last_status = node->is_timed ? run_timed(node) : run_untimed(node);
+	}
+	return last_status;
+}
+
+// Everything parsed from a buffer goes into one arena, which is reset after
+// each '&&`/'||` chain has run
+int run_buffer(Buffer *buffer)
+{
+	static Arena arena;
+	bool is_failed = false;
+	for (Node *node = get_next_node(&buffer, &arena, true, &is_failed); node != NULL; node = get_next_node(&buffer, &arena, true, &is_failed)) {
+		run_nodes(node);
+		arena_reset(&arena);
+		if (exit_requested) {
+			break;
+		}
+	}
+	if (is_failed) {
+		last_status = 2;
+	}
+	arena_reset(&arena);
+	return last_status;
+}
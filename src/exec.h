@@ -0,0 +1,23 @@
+#ifndef EXEC_H_
+#define EXEC_H_
+
+extern int last_status;
+
+// Set by break, continue and return to leave the commands running early
+extern size_t loop_depth;
+extern size_t break_levels;
+extern size_t continue_levels;
+extern size_t function_depth;
+extern bool return_requested;
+
+// Set with 'set -o explain` to print how each pipeline was rewritten
+extern bool is_explaining;
+
+void set_positional_args(char **args);
+char *expand_word(char *word);
+char *find_executable(char *name); // Remembered until PATH changes, NULL if not found
+int run_commands(Command *commands, size_t count);
+int run_nodes(Node *node);
+int run_buffer(Buffer *buffer);
+
+#endif // EXEC_H_
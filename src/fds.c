@@ -0,0 +1,226 @@
+#define _GNU_SOURCE // pipe2, dup3
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "fds.h"
+
+#define FD_TRACK_CAP 1024 // Higher descriptors are only closed on exec
+#define FD_WORD_BITS 64
+#define FD_KEEP_MIN 10 // Redirects are almost always to descriptors below this
+#define FD_OWNER_CAP 32
+
+// Set and cleared atomically since the prompt's git worker opens pipes on its
+// own thread, and read without a lock after fork since a child may have been
+// forked while another thread held one
+static atomic_ullong tracked[FD_TRACK_CAP / FD_WORD_BITS];
+
+// Only the main thread runs commands, so only it ever lends descriptors
+static int *owners[FD_OWNER_CAP];
+static size_t num_owners = 0;
+static pthread_rwlock_t lent_lock = PTHREAD_RWLOCK_INITIALIZER;
+static size_t num_lent = 0;
+static pthread_once_t fork_handled = PTHREAD_ONCE_INIT;
+
+// The standard descriptors are never tracked, a redirect or pipe that lands
+// on one is what the child is meant to keep
+int track_fd(int fd)
+{
+	if (fd <= STDERR_FILENO) {
+		return fd;
+	}
+	int flags = fcntl(fd, F_GETFD);
+	if (flags != -1 && (flags & FD_CLOEXEC) == 0) {
+		fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
+	}
+	if (fd < FD_TRACK_CAP) {
+		atomic_fetch_or(&tracked[fd / FD_WORD_BITS], 1ULL << (fd % FD_WORD_BITS));
+	}
+	return fd;
+}
+
+void untrack_fd(int fd)
+{
+	if (fd > STDERR_FILENO && fd < FD_TRACK_CAP) {
+		atomic_fetch_and(&tracked[fd / FD_WORD_BITS], ~(1ULL << (fd % FD_WORD_BITS)));
+	}
+}
+
+int open_fd(char *path, int flags, mode_t mode)
+{
+	int fd = open(path, flags | O_CLOEXEC, mode);
+	return (fd == -1) ? -1 : track_fd(fd);
+}
+
+// Both ends are close-on-exec from the start so a fork on another thread
+// can't catch them without it
+bool open_pipe(int *fds)
+{
+#ifdef __linux__
+	if (pipe2(fds, O_CLOEXEC) == -1) {
+		return false;
+	}
+#else
+	if (pipe(fds) == -1) {
+		return false;
+	}
+#endif
+	track_fd(fds[0]);
+	track_fd(fds[1]);
+	return true;
+}
+
+int dup_fd(int fd, int lowest)
+{
+	int copy = fcntl(fd, F_DUPFD_CLOEXEC, lowest);
+	return (copy == -1) ? -1 : track_fd(copy);
+}
+
+// Descriptors that stay open while commands run are moved up out of the way,
+// or a redirect like '3>file` in the shell itself would take one over
+int keep_fd(int fd)
+{
+	if (fd == -1 || fd >= FD_KEEP_MIN) {
+		return (fd == -1) ? -1 : track_fd(fd);
+	}
+	int kept = dup_fd(fd, FD_KEEP_MIN);
+	if (kept == -1) {
+		return track_fd(fd);
+	}
+	close_fd(fd);
+	return kept;
+}
+
+void close_fd(int fd)
+{
+	untrack_fd(fd);
+	close(fd);
+}
+
+static bool is_tracked(int fd)
+{
+	return fd > STDERR_FILENO && fd < FD_TRACK_CAP && (atomic_load(&tracked[fd / FD_WORD_BITS]) >> (fd % FD_WORD_BITS)) & 1;
+}
+
+void own_fd(int *fd)
+{
+	if (num_owners < FD_OWNER_CAP) {
+		owners[num_owners++] = fd;
+	}
+}
+
+void disown_fd(int *fd)
+{
+	for (size_t i = 0; i < num_owners; ++i) {
+		if (owners[i] == fd) {
+			owners[i] = owners[--num_owners];
+			return;
+		}
+	}
+}
+
+// A child may have been forked while another thread was holding the lock,
+// and it's the only thread the child has
+static void reset_in_child(void)
+{
+	pthread_rwlock_init(&lent_lock, NULL);
+	if (num_lent > 0) {
+		pthread_rwlock_wrlock(&lent_lock);
+	}
+}
+
+static void handle_fork(void)
+{
+	pthread_atfork(NULL, NULL, reset_in_child);
+}
+
+// Returns true if the descriptor was lent, in which case it has to be saved
+// and given back with give_back_fd() once the redirect is undone
+bool lend_fd(int fd)
+{
+	if (!is_tracked(fd)) {
+		return false;
+	}
+	pthread_once(&fork_handled, handle_fork);
+	if (num_lent++ == 0) {
+		pthread_rwlock_wrlock(&lent_lock);
+	}
+	for (size_t i = 0; i < num_owners; ++i) {
+		int moved;
+		if (*owners[i] == fd && (moved = dup_fd(fd, FD_KEEP_MIN)) != -1) {
+			*owners[i] = moved;
+			close_fd(fd);
+			give_back_fd(-1, fd);
+			return false;
+		}
+	}
+	return true;
+}
+
+// The copy is made close-on-exec as it's put back, so a fork on another
+// thread can't catch it without it
+void give_back_fd(int saved, int fd)
+{
+	if (saved != -1) {
+#ifdef __linux__
+		dup3(saved, fd, O_CLOEXEC);
+#else
+		dup2(saved, fd);
+#endif
+		close_fd(saved);
+		track_fd(fd);
+	}
+	if (--num_lent == 0) {
+		pthread_rwlock_unlock(&lent_lock);
+	}
+}
+
+void hold_kept_fds(void)
+{
+	pthread_once(&fork_handled, handle_fork);
+	pthread_rwlock_rdlock(&lent_lock);
+}
+
+bool try_hold_kept_fds(void)
+{
+	pthread_once(&fork_handled, handle_fork);
+	return pthread_rwlock_tryrdlock(&lent_lock) == 0;
+}
+
+void release_kept_fds(void)
+{
+	pthread_rwlock_unlock(&lent_lock);
+}
+
+// Everything tracked is close-on-exec already, this is for a child that goes
+// on running hush, like the server's. They're mostly handed out lowest
+// first, so they're nearly always one run that a single close_range() gets
+// rid of. Without it only the tracked ones are closed one by one, never
+// everything up to the limit.
+void close_tracked_fds(void)
+{
+	int begin = -1;
+	for (int fd = 0; fd <= FD_TRACK_CAP; ++fd) {
+		bool is_tracked = fd < FD_TRACK_CAP && (atomic_load_explicit(&tracked[fd / FD_WORD_BITS], memory_order_relaxed) >> (fd % FD_WORD_BITS)) & 1;
+		if (is_tracked && begin == -1) {
+			begin = fd;
+		} else if (!is_tracked && begin != -1) {
+#ifdef SYS_close_range
+			if (syscall(SYS_close_range, (unsigned int) begin, (unsigned int) fd - 1, 0) == 0) {
+				begin = -1;
+				continue;
+			}
+#endif
+			for (; begin < fd; ++begin) {
+				close(begin);
+			}
+			begin = -1;
+		}
+	}
+	for (size_t i = 0; i < FD_TRACK_CAP / FD_WORD_BITS; ++i) {
+		atomic_store_explicit(&tracked[i], 0, memory_order_relaxed);
+	}
+}
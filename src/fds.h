@@ -0,0 +1,29 @@
+#ifndef FDS_H_
+#define FDS_H_
+
+// Descriptors the shell opens for itself go through these so they're all
+// closed on exec and children can drop every one of them at once. Anything
+// hush was started with is left alone and passed on, like other shells do.
+int track_fd(int fd);
+void untrack_fd(int fd);
+int open_fd(char *path, int flags, mode_t mode);
+bool open_pipe(int *fds);
+int dup_fd(int fd, int lowest);
+int keep_fd(int fd);
+void close_fd(int fd);
+void close_tracked_fds(void);
+
+// A redirect in the shell itself can land on a descriptor the shell keeps.
+// Ones whose owner only holds their number are moved out of the way, the
+// rest are lent to the redirect and given back after it. Other threads that
+// use kept descriptors do it while holding them, so they wait while any are
+// lent.
+void own_fd(int *fd);
+void disown_fd(int *fd);
+bool lend_fd(int fd);
+void give_back_fd(int saved, int fd);
+void hold_kept_fds(void);
+bool try_hold_kept_fds(void);
+void release_kept_fds(void);
+
+#endif // FDS_H_
@@ -0,0 +1,136 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer.h"
+#include "lexer.h"
+#include "arena.h"
+#include "parser.h"
+#include "funcs.h"
+#include "table.h"
+
+static Table aliases;
+static Table functions;
+
+// Functions live as long as the shell, redefining one leaves the old copy
+// behind
+static Arena definitions;
+
+// Each alias has its own arena so it can be freed when it's removed or
+// redefined. An alias being run may do that to itself, so the old one is
+// only retired until no commands are running.
+typedef struct Alias Alias;
+struct Alias {
+	Command_List list;
+	Arena arena;
+	Alias *next_retired;
+};
+
+static Alias *retired_aliases = NULL;
+
+static void *lookup(Table *table, char *name)
+{
+	if (table->count == 0) {
+		return NULL;
+	}
+	Table_Entry *entry = table_find(table, name, strlen(name));
+	return (entry == NULL) ? NULL : entry->value;
+}
+
+Command_List *get_alias(char *name)
+{
+	Alias *alias = (Alias *) lookup(&aliases, name);
+	return (alias == NULL) ? NULL : &alias->list;
+}
+
+Node *get_function(char *name)
+{
+	return (Node *) lookup(&functions, name);
+}
+
+static void retire_alias(Alias *alias)
+{
+	alias->next_retired = retired_aliases;
+	retired_aliases = alias;
+}
+
+void free_retired_aliases(void)
+{
+	while (retired_aliases != NULL) {
+		Alias *alias = retired_aliases;
+		retired_aliases = alias->next_retired;
+		free(alias->list.text);
+		free(alias->list.commands);
+		arena_free(&alias->arena);
+		free(alias);
+	}
+}
+
+bool define_alias(char *name, size_t name_len, char *text)
+{
+	Buffer buffer = {0};
+	set_buffer(&buffer, text, strlen(text));
+
+	Alias *alias = (Alias *) calloc(1, sizeof (Alias));
+	if (alias == NULL) {
+		fprintf(stderr, "hush: unable to allocate memory\n");
+		exit(EXIT_FAILURE);
+	}
+	Command_List list = {0};
+	size_t cap = 0;
+	bool is_failed;
+	for (Command command = get_next_command(&buffer, &is_failed); command.name != NULL; command = get_next_command(&buffer, &is_failed)) {
+		if (list.count == cap) {
+			cap = (cap == 0) ? 2 : 2 * cap;
+			list.commands = (Command *) realloc(list.commands, cap * sizeof (Command));
+		}
+		list.commands[list.count++] = copy_command(&alias->arena, command);
+		free(command.args);
+		free(command.redirects);
+	}
+	free(buffer.text);
+	if (is_failed || list.count == 0) {
+		if (!is_failed) {
+			fprintf(stderr, "hush: alias: '%.*s` has no command\n", (int) name_len, name);
+		}
+		free(list.commands);
+		arena_free(&alias->arena);
+		free(alias);
+		return false;
+	}
+	list.text = strdup(text);
+	alias->list = list;
+	Table_Entry *entry = table_insert(&aliases, name, name_len);
+	if (entry->value != NULL) {
+		retire_alias((Alias *) entry->value);
+	}
+	entry->value = alias;
+	return true;
+}
+
+bool remove_alias(char *name)
+{
+	Table_Entry *entry = table_find(&aliases, name, strlen(name));
+	if (entry == NULL || entry->value == NULL) {
+		return false;
+	}
+	retire_alias((Alias *) entry->value);
+	entry->value = NULL;
+	return true;
+}
+
+void print_aliases(void)
+{
+	for (size_t i = 0; i < aliases.cap; ++i) {
+		Table_Entry *entry = &aliases.entries[i];
+		if (entry->value != NULL) {
+			printf("alias %s='%s'\n", entry->key, ((Alias *) entry->value)->list.text);
+		}
+	}
+}
+
+void define_function(char *name, size_t name_len, Node *body)
+{
+	table_insert(&functions, name, name_len)->value = copy_node(&definitions, body);
+}
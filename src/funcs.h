@@ -0,0 +1,21 @@
+#ifndef FUNCS_H_
+#define FUNCS_H_
+
+// Aliases and functions are parsed once when they're defined and run from
+// these copies every time they're used. Aliases are flat lists of commands,
+// functions keep the whole tree of their body.
+typedef struct {
+	char *text; // What an alias was defined as, for printing
+	Command *commands;
+	size_t count;
+} Command_List;
+
+Command_List *get_alias(char *name);
+Node *get_function(char *name);
+bool define_alias(char *name, size_t name_len, char *text);
+bool remove_alias(char *name);
+void free_retired_aliases(void); // Once no commands are running
+void print_aliases(void);
+void define_function(char *name, size_t name_len, Node *body);
+
+#endif // FUNCS_H_
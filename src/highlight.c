@@ -0,0 +1,276 @@
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "buffer.h"
+#include "lexer.h"
+#include "arena.h"
+#include "parser.h"
+#include "builtin.h"
+#include "funcs.h"
+#include "highlight.h"
+#include "table.h"
+#include "vars.h"
+
+#define STYLE_SEQUENCE(style, sequence) sequence,
+static char *style_sequences[] = {
+	FOR_STYLES(STYLE_SEQUENCE)
+};
+#undef STYLE_SEQUENCE
+
+// Keywords name what runs like commands do, and all but 'for` are followed
+// by another command
+static char *keywords[] = {"if", "then", "elif", "else", "fi", "while", "until", "for", "do", "done", "{", "}", "time", NULL};
+
+// Every name in the PATH directories, read once and only read again when
+// PATH or one of the directories changes. Any value but NULL marks a name as
+// being there.
+typedef struct {
+	char *path;
+	time_t mtime;
+} Path_Dir;
+
+static Table path_names;
+static Path_Dir *path_dirs = NULL;
+static size_t num_path_dirs = 0;
+static unsigned long path_names_version = 0;
+static bool is_path_loaded = false;
+static bool is_path_checked = false; // Directories are looked at once a line
+
+// Lexemes of the line being edited, along with what they're shown as
+typedef struct {
+	Lexeme_Span span;
+	bool is_command; // In command position, where a word names what runs
+	unsigned char style;
+} Token;
+
+typedef struct {
+	Token *tokens;
+	size_t count;
+	size_t cap;
+} Token_List;
+
+static Token_List line_tokens;
+static Token_List scanned; // Tokens lexed again after an edit
+static unsigned char *styles = NULL;
+static size_t styles_cap = 0;
+static size_t line_len = 0;
+static char *name = NULL; // Command names are copied here to look them up
+static size_t name_cap = 0;
+
+static void *reserve(void *pointer, size_t *cap, size_t len, size_t size)
+{
+	if (len <= *cap) {
+		return pointer;
+	}
+	*cap = (*cap == 0) ? 64 : *cap;
+	while (*cap < len) {
+		*cap *= 2;
+	}
+	pointer = realloc(pointer, *cap * size);
+	if (pointer == NULL) {
+		fprintf(stderr, "hush: unable to allocate memory\n");
+		exit(EXIT_FAILURE);
+	}
+	return pointer;
+}
+
+char *get_style_sequence(unsigned char style)
+{
+	return style_sequences[style];
+}
+
+static void load_path_names(char *path_var)
+{
+	for (size_t i = 0; i < path_names.cap; ++i) {
+		path_names.entries[i].value = NULL;
+	}
+	for (size_t i = 0; i < num_path_dirs; ++i) {
+		free(path_dirs[i].path);
+	}
+	num_path_dirs = 0;
+
+	size_t dirs_cap = 0;
+	for (char *dir = path_var, *dir_end; *dir != '\0'; dir = (*dir_end == ':') ? dir_end + 1 : dir_end) {
+		dir_end = strchr(dir, ':');
+		if (dir_end == NULL) {
+			dir_end = dir + strlen(dir);
+		}
+		if (dir_end == dir) {
+			continue;
+		}
+		path_dirs = (Path_Dir *) reserve(path_dirs, &dirs_cap, num_path_dirs + 1, sizeof (Path_Dir));
+		Path_Dir *path_dir = &path_dirs[num_path_dirs++];
+		path_dir->path = strndup(dir, dir_end - dir);
+		struct stat dir_stat;
+		path_dir->mtime = (stat(path_dir->path, &dir_stat) == 0) ? dir_stat.st_mtime : 0;
+
+		DIR *entries = opendir(path_dir->path);
+		if (entries == NULL) {
+			continue;
+		}
+		for (struct dirent *entry = readdir(entries); entry != NULL; entry = readdir(entries)) {
+			if (entry->d_name[0] != '.' && entry->d_type != DT_DIR) {
+				Table_Entry *name_entry = table_insert(&path_names, entry->d_name, strlen(entry->d_name));
+				name_entry->value = name_entry->key;
+			}
+		}
+		closedir(entries);
+	}
+	path_names_version = path_version;
+	is_path_loaded = true;
+}
+
+static bool is_path_stale(void)
+{
+	if (!is_path_loaded || path_names_version != path_version) {
+		return true;
+	}
+	for (size_t i = 0; i < num_path_dirs; ++i) {
+		struct stat dir_stat;
+		time_t mtime = (stat(path_dirs[i].path, &dir_stat) == 0) ? dir_stat.st_mtime : 0;
+		if (mtime != path_dirs[i].mtime) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool is_command_found(size_t name_len)
+{
+	if (get_builtin(name) != NULL || get_alias(name) != NULL || get_function(name) != NULL) {
+		return true;
+	}
+	if (strchr(name, '/') != NULL) {
+		return access(name, X_OK) == 0;
+	}
+	if (!is_path_checked) {
+		if (is_path_stale()) {
+			char *path_var = get_var("PATH", 4);
+			load_path_names((path_var == NULL) ? "/usr/local/bin:/usr/bin:/bin" : path_var);
+		}
+		is_path_checked = true;
+	}
+	Table_Entry *entry = table_find(&path_names, name, name_len);
+	return entry != NULL && entry->value != NULL;
+}
+
+static bool is_keyword(char *word)
+{
+	for (char **keyword = keywords; *keyword != NULL; ++keyword) {
+		if (strcmp(word, *keyword) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Also works out whether the next word is in command position
+static unsigned char get_token_style(char *text, Lexeme_Span span, bool *is_command)
+{
+	if (span.type == HUSH_LEXEME_TYPE_END_OF_COMMAND) {
+		*is_command = true;
+		return HUSH_STYLE_OPERATOR;
+	}
+	if (span.type == HUSH_LEXEME_TYPE_FILE_REDIRECT) {
+		return HUSH_STYLE_REDIRECT;
+	}
+	if (!*is_command) {
+		return HUSH_STYLE_ARGUMENT;
+	}
+	size_t name_len = span.end - span.begin;
+	name = (char *) reserve(name, &name_cap, name_len + 1, sizeof (char));
+	memcpy(name, text + span.begin, name_len);
+	name[name_len] = '\0';
+	if (get_assignment_name_len(name) > 0) {
+		return HUSH_STYLE_ARGUMENT;
+	}
+	if (is_keyword(name)) {
+		*is_command = strcmp(name, "for") != 0;
+		return HUSH_STYLE_COMMAND;
+	}
+	*is_command = false;
+
+	// What a quoted or substituted name runs is only known once it's expanded
+	if (strpbrk(name, "'\"\\$`") != NULL) {
+		return HUSH_STYLE_COMMAND;
+	}
+	return is_command_found(name_len) ? HUSH_STYLE_COMMAND : HUSH_STYLE_MISSING_COMMAND;
+}
+
+void reset_highlight(void)
+{
+	line_tokens.count = 0;
+	line_len = 0;
+	is_path_checked = false;
+}
+
+// Brings the styles up to date with an edit that replaced the old line's
+// bytes from edit_begin to old_edit_end with the new line's up to
+// new_edit_end. Lexing starts again from the token before the edit, since a
+// redirect may have just taken its word, and stops as soon as it reaches a
+// token that's the same as before the edit. Everything after that keeps its
+// style, only the dirty range has been looked at again.
+unsigned char *highlight_line(char *text, size_t len, size_t edit_begin, size_t old_edit_end, size_t new_edit_end, size_t *dirty_begin, size_t *dirty_end)
+{
+	styles = (unsigned char *) reserve(styles, &styles_cap, len + 1, sizeof (unsigned char));
+	memmove(styles + new_edit_end, styles + old_edit_end, line_len - old_edit_end);
+	line_len = len;
+
+	size_t first = 0;
+	for (; first < line_tokens.count && line_tokens.tokens[first].span.end < edit_begin; ++first);
+	first = (first > 0) ? first - 1 : 0;
+	size_t begin = (first > 0) ? line_tokens.tokens[first].span.begin : 0;
+	bool is_command = (first > 0) ? line_tokens.tokens[first].is_command : true;
+
+	Buffer buffer = {.text = text, .cursor = text + begin, .end = text + len};
+	size_t end = len, old = first;
+	bool is_synced = false;
+	scanned.count = 0;
+	while (true) {
+		Lexeme_Span span = scan_next_lexeme(&buffer);
+		if (span.type == HUSH_LEXEME_TYPE_END_OF_BUFFER) {
+			break;
+		}
+
+		// Lexing only looks ahead, so past the edit it comes out the same
+		// from any old token it lines up with
+		if (span.begin >= new_edit_end) {
+			size_t old_begin = span.begin - new_edit_end + old_edit_end;
+			for (; old < line_tokens.count && line_tokens.tokens[old].span.begin < old_begin; ++old);
+			if (old < line_tokens.count && line_tokens.tokens[old].span.begin == old_begin && line_tokens.tokens[old].is_command == is_command) {
+				end = span.begin;
+				is_synced = true;
+				break;
+			}
+		}
+		scanned.tokens = (Token *) reserve(scanned.tokens, &scanned.cap, scanned.count + 1, sizeof (Token));
+		Token *token = &scanned.tokens[scanned.count++];
+		token->span = span;
+		token->is_command = is_command;
+		token->style = get_token_style(text, span, &is_command);
+	}
+
+	// Splice what was lexed in between the tokens before and after the edit
+	size_t num_kept = is_synced ? line_tokens.count - old : 0;
+	line_tokens.tokens = (Token *) reserve(line_tokens.tokens, &line_tokens.cap, first + scanned.count + num_kept, sizeof (Token));
+	memmove(line_tokens.tokens + first + scanned.count, line_tokens.tokens + old, num_kept * sizeof (Token));
+	memcpy(line_tokens.tokens + first, scanned.tokens, scanned.count * sizeof (Token));
+	line_tokens.count = first + scanned.count + num_kept;
+	for (size_t i = first + scanned.count; i < line_tokens.count; ++i) {
+		line_tokens.tokens[i].span.begin = line_tokens.tokens[i].span.begin - old_edit_end + new_edit_end;
+		line_tokens.tokens[i].span.end = line_tokens.tokens[i].span.end - old_edit_end + new_edit_end;
+	}
+
+	memset(styles + begin, HUSH_STYLE_NONE, end - begin);
+	for (size_t i = 0; i < scanned.count; ++i) {
+		memset(styles + scanned.tokens[i].span.begin, scanned.tokens[i].style, scanned.tokens[i].span.end - scanned.tokens[i].span.begin);
+	}
+	*dirty_begin = begin;
+	*dirty_end = end;
+	return styles;
+}
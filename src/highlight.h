@@ -0,0 +1,25 @@
+#ifndef HIGHLIGHT_H_
+#define HIGHLIGHT_H_
+
+// Only the foreground is ever set, so going back to the default one is all
+// it takes to end a style
+#define FOR_STYLES(DO) \
+	DO(NONE, "\033[39m") \
+	DO(COMMAND, "\033[32m") \
+	DO(MISSING_COMMAND, "\033[31m") \
+	DO(ARGUMENT, "\033[36m") \
+	DO(REDIRECT, "\033[33m") \
+	DO(OPERATOR, "\033[35m") \
+	DO(SUGGESTION, "\033[90m") \
+
+#define STYLE_ENUM(style, sequence) HUSH_STYLE_##style,
+typedef enum {
+	FOR_STYLES(STYLE_ENUM)
+} Hush_Style;
+#undef STYLE_ENUM
+
+char *get_style_sequence(unsigned char style);
+void reset_highlight(void);
+unsigned char *highlight_line(char *text, size_t len, size_t edit_begin, size_t old_edit_end, size_t new_edit_end, size_t *dirty_begin, size_t *dirty_end);
+
+#endif // HIGHLIGHT_H_
@@ -17,6 +17,7 @@ static char *get_lexeme_type_string(Hush_Lexeme_Type type)
 		case HUSH_LEXEME_TYPE_FILE_REDIRECT: return "HUSH_LEXEME_TYPE_FILE_REDIRECT";
 		case HUSH_LEXEME_TYPE_END_OF_COMMAND: return "HUSH_LEXEME_TYPE_END_OF_COMMAND";
 		case HUSH_LEXEME_TYPE_END_OF_BUFFER: return "HUSH_LEXEME_TYPE_END_OF_BUFFER";
+		case HUSH_LEXEME_TYPE_ERROR: return "HUSH_LEXEME_TYPE_ERROR";
 		default: return NULL;
 	}
 }
@@ -31,20 +32,169 @@ void print_lexeme(Lexeme lexeme)
 		printf("	 input_fd = %d\n", lexeme.file_redirect.input_fd);
 		printf("	output_fd = %d\n", lexeme.file_redirect.output_fd);
 		printf("	     mode = %d\n", lexeme.file_redirect.mode);
+		if (lexeme.file_redirect.word != NULL) {
+			printf("	     word = '%s`\n", lexeme.file_redirect.word);
+		}
+		if (lexeme.file_redirect.here_document != NULL) {
+			printf("	     here = '%.*s`\n", (int) lexeme.file_redirect.here_document_len, lexeme.file_redirect.here_document);
+		}
 	}
 	printf("\n");
 }
 
+// Set by a thread that parses ahead of the commands being run, so what it
+// reports can be held back until they've caught up
+static _Thread_local FILE *parse_errors = NULL;
+
+void set_parse_errors(FILE *file)
+{
+	parse_errors = file;
+}
+
+FILE *get_parse_errors(void)
+{
+	return (parse_errors == NULL) ? stderr : parse_errors;
+}
+
+// A here-document inside a substitution is only read once the substitution
+// runs, from the same input the commands after it come from
+static _Thread_local bool has_deferred_input = false;
+
+bool take_deferred_input(void)
+{
+	bool result = has_deferred_input;
+	has_deferred_input = false;
+	return result;
+}
+
 static bool is_wspace(char chr)
 {
 	return isspace(chr) || chr == '\0';
 }
 
+// Newlines only turn up in a buffer joined from several lines, where they end
+// the command like ';` does
+static bool is_blank(char chr)
+{
+	return is_wspace(chr) && chr != '\n';
+}
+
 static bool is_lexeme_term(char chr)
 {
 	return chr == ';' || chr == '|' || chr == '<' || chr == '>' || is_wspace(chr);
 }
 
+// '&&` ends a word even without spaces around it, a lone '&` doesn't
+static bool is_word_end(char *cursor, char *end)
+{
+	return is_lexeme_term(*cursor) || (*cursor == '&' && cursor + 1 < end && *(cursor + 1) == '&');
+}
+
+static bool is_substitution_start(char *cursor, char *end)
+{
+	return *cursor == '`' || (*cursor == '$' && cursor + 1 < end && *(cursor + 1) == '(');
+}
+
+static char *find_quote_end(char *begin, char *end);
+
+char *find_substitution_end(char *begin, char *end)
+{
+	if (*begin == '`') {
+		for (++begin; begin < end && *begin != '`'; ++begin);
+		return (begin < end) ? begin : NULL;
+	}
+	size_t depth = 0;
+	for (begin += 2; begin < end; ++begin) {
+		if (*begin == '\\' && begin + 1 < end) {
+			++begin;
+		} else if (*begin == '\'' || *begin == '"') {
+			if ((begin = find_quote_end(begin, end)) == NULL) {
+				return NULL;
+			}
+		} else if (*begin == '(') {
+			++depth;
+		} else if (*begin == ')' && depth-- == 0) {
+			return begin;
+		}
+	}
+	return NULL;
+}
+
+static char *find_quote_end(char *begin, char *end)
+{
+	char quote_type = *begin;
+	for (++begin; begin < end && *begin != quote_type; ++begin) {
+		if (quote_type == '\'') {
+			continue;
+		}
+		if (*begin == '\\' && begin + 1 < end) {
+			++begin;
+		} else if (is_substitution_start(begin, end)) {
+			if ((begin = find_substitution_end(begin, end)) == NULL) {
+				return NULL;
+			}
+		}
+	}
+	return (begin < end) ? begin : NULL;
+}
+
+// Moves the cursor past the current word, skipping over anything quoted or
+// substituted since those are only expanded when the command runs. Anything
+// left open runs to the end of the buffer, and the quote or bracket it's
+// missing is returned, otherwise '\0`.
+static char skip_word(Buffer *buffer, bool should_report)
+{
+	char *begin = buffer->cursor;
+	bool has_substitution = false;
+	for (; buffer->cursor < buffer->end && !is_word_end(buffer->cursor, buffer->end); ++buffer->cursor) {
+		if (*buffer->cursor == '\\' && buffer->cursor + 1 < buffer->end) {
+			++buffer->cursor;
+		} else if (*buffer->cursor == '\'' || *buffer->cursor == '"') {
+			char *quote_end = find_quote_end(buffer->cursor, buffer->end);
+			if (quote_end == NULL) {
+				char missing = *buffer->cursor;
+				buffer->cursor = buffer->end;
+				return missing;
+			}
+			buffer->cursor = quote_end;
+		} else if (is_substitution_start(buffer->cursor, buffer->end)) {
+			has_substitution = true;
+			char *subst_end = find_substitution_end(buffer->cursor, buffer->end);
+			if (subst_end == NULL) {
+				char missing = (*buffer->cursor == '`') ? '`' : ')';
+				buffer->cursor = buffer->end;
+				return missing;
+			}
+			buffer->cursor = subst_end;
+		}
+	}
+
+	// Quotes can hide a substitution too, so the whole word is looked at. A
+	// body on the lines after the '<<` comes with the substitution instead.
+	for (char *chr = begin; should_report && chr < buffer->cursor; ++chr) {
+		has_substitution = has_substitution || is_substitution_start(chr, buffer->cursor);
+	}
+	for (char *chr = begin; should_report && has_substitution && chr + 1 < buffer->cursor; ++chr) {
+		if (chr[0] == '<' && chr[1] == '<' && (chr + 2 == buffer->cursor || chr[2] != '<') && \
+				memchr(chr, '\n', buffer->cursor - chr) == NULL) {
+			has_deferred_input = true;
+			break;
+		}
+	}
+	return '\0';
+}
+
+static Lexeme report_open_word(Lexeme result, char missing)
+{
+	if (missing == '\'' || missing == '"') {
+		fprintf(get_parse_errors(), "hush: parse error, missing closing quote\n");
+	} else {
+		fprintf(get_parse_errors(), "hush: parse error, missing closing '%c`\n", missing);
+	}
+	result.type = HUSH_LEXEME_TYPE_ERROR;
+	return result;
+}
+
 static char *get_file_redirect_mode_string(int mode)
 {
 	switch (mode) {
@@ -56,14 +206,137 @@ static char *get_file_redirect_mode_string(int mode)
 	}
 }
 
+static void append_here_line(char **body, size_t *len, size_t *cap, char *line, size_t line_len)
+{
+	if (*len + line_len + 1 > *cap) {
+		while (*len + line_len + 1 > *cap) {
+			*cap = (*cap == 0) ? 256 : 2 * *cap;
+		}
+		*body = (char *) realloc(*body, *cap * sizeof (char));
+		if (*body == NULL) {
+			fprintf(stderr, "hush: unable to allocate memory\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	memcpy(*body + *len, line, line_len);
+	*len += line_len;
+	(*body)[(*len)++] = '\n';
+}
+
+// Handles '<<word`, '<<-word` and '<<<word` with the cursor just past '<<`
+static Lexeme get_here_document(Buffer *buffer, Lexeme result)
+{
+	bool is_here_string = false, strip_tabs = false;
+	if (buffer->cursor < buffer->end && *buffer->cursor == '<') {
+		is_here_string = true;
+		++buffer->cursor;
+	} else if (buffer->cursor < buffer->end && *buffer->cursor == '-') {
+		strip_tabs = true;
+		++buffer->cursor;
+	}
+	for (; buffer->cursor < buffer->end && is_blank(*buffer->cursor); ++buffer->cursor);
+	char *begin = buffer->cursor;
+	char missing = skip_word(buffer, true);
+	if (missing != '\0') {
+		return report_open_word(result, missing);
+	}
+	if (buffer->cursor == begin) {
+		fprintf(get_parse_errors(), "hush: parse error after '%s`\n", is_here_string ? "<<<" : "<<");
+		result.type = HUSH_LEXEME_TYPE_ERROR;
+		return result;
+	}
+	size_t word_len = buffer->cursor - begin;
+
+	char *body = NULL;
+	size_t len = 0, cap = 0;
+	if (is_here_string) {
+		body = strndup(begin, word_len);
+		len = word_len;
+		result.file_redirect.is_here_string = true;
+	} else {
+
+		// Quotes around the delimiter are only meaningful for expansion, so drop them
+		char *delim = (char *) malloc((word_len + 1) * sizeof (char));
+		size_t delim_len = 0;
+		for (char *chr = begin; chr < buffer->cursor; ++chr) {
+			if (*chr != '\'' && *chr != '"') {
+				delim[delim_len++] = *chr;
+			}
+		}
+		delim[delim_len] = '\0';
+
+		// A substitution written over several lines already holds the body,
+		// which is taken out so the rest of it lexes as if it was never there
+		char *line_end = memchr(buffer->cursor, '\n', buffer->end - buffer->cursor);
+		bool is_delimited = false;
+		if (line_end != NULL) {
+			char *line = line_end + 1, *next;
+			for (; line < buffer->end && !is_delimited; line = next) {
+				char *newline = memchr(line, '\n', buffer->end - line);
+				next = (newline == NULL) ? buffer->end : newline + 1;
+				size_t line_len = ((newline == NULL) ? buffer->end : newline) - line;
+				char *text = line;
+				for (; strip_tabs && line_len > 0 && *text == '\t'; ++text, --line_len);
+				if (line_len == delim_len && memcmp(text, delim, delim_len) == 0) {
+					is_delimited = true;
+				} else {
+					append_here_line(&body, &len, &cap, text, line_len);
+				}
+			}
+			memmove(line_end + 1, line, buffer->end - line);
+			buffer->end -= line - (line_end + 1);
+			*buffer->end = '\0';
+		} else {
+			char *line;
+			while ((line = get_next_line("> ")) != NULL) {
+				if (strip_tabs) {
+					for (; *line == '\t'; ++line);
+				}
+				if (strcmp(line, delim) == 0) {
+					is_delimited = true;
+					break;
+				}
+				append_here_line(&body, &len, &cap, line, strlen(line));
+			}
+		}
+		if (!is_delimited) {
+			fprintf(get_parse_errors(), "hush: here-document delimited by end of file (wanted '%s`)\n", delim);
+		}
+		free(delim);
+	}
+
+	result.file_redirect.output_fd = -1;
+	result.file_redirect.here_document = (body == NULL) ? strdup("") : body;
+	result.file_redirect.here_document_len = len;
+	return result;
+}
+
 Lexeme get_next_lexeme(Buffer *buffer)
 {
 	Lexeme result = {0};
-	for (; buffer->cursor < buffer->end && is_wspace(*buffer->cursor); ++buffer->cursor);
+	for (; buffer->cursor < buffer->end && is_blank(*buffer->cursor); ++buffer->cursor);
+	if (buffer->cursor < buffer->end && *buffer->cursor == '#') {
+		for (; buffer->cursor < buffer->end && *buffer->cursor != '\n'; ++buffer->cursor);
+	}
 	if (buffer->cursor == buffer->end) {
 		result.type = HUSH_LEXEME_TYPE_END_OF_BUFFER;
 		return result;
 	}
+	if (*buffer->cursor == '\n') {
+		result.type = HUSH_LEXEME_TYPE_END_OF_COMMAND;
+		result.content = "\n";
+		++buffer->cursor;
+		return result;
+	}
+
+	// '&&` and '||` end a command like ';` does, the parser decides what they mean
+	if (buffer->cursor + 1 < buffer->end && (*buffer->cursor == '&' || *buffer->cursor == '|') && \
+			*(buffer->cursor + 1) == *buffer->cursor) {
+		result.type = HUSH_LEXEME_TYPE_END_OF_COMMAND;
+		result.content = (*buffer->cursor == '&') ? "&&" : "||";
+		buffer->cursor += 2;
+		return result;
+	}
 
 	switch (*buffer->cursor) {
 		case '|': 
@@ -79,7 +352,7 @@ Lexeme get_next_lexeme(Buffer *buffer)
 				result.content = (char *) malloc(2 * sizeof (char));
 				if (result.content == NULL) {
 					fprintf(stderr, "hush: unable to allocate memory\n");
-					result.type = HUSH_LEXEME_TYPE_END_OF_BUFFER;
+					result.type = HUSH_LEXEME_TYPE_ERROR;
 					return result;
 				}
 				result.content[0] = *(buffer->cursor - 1);
@@ -87,20 +360,6 @@ Lexeme get_next_lexeme(Buffer *buffer)
 			}
 			break;
 		}
-		// case '\'':
-		// case '"': {
-		// 	result.type = HUSH_LEXEME_TYPE_STRING;
-		// 	char quote_type = *(buffer->cursor++);
-		// 	result.content = buffer->cursor;
-		// 	for (; buffer->cursor < buffer->end && *buffer->cursor != quote_type; ++buffer->cursor);
-		// 	if (buffer->cursor == buffer->end) {
-		// 		fprintf(stderr, "hush: parse error, missing closing quote\n");
-		// 		result.type = HUSH_LEXEME_TYPE_END_OF_BUFFER;
-		// 		return result;
-		// 	}
-		// 	*(buffer->cursor++) = '\0';
-		// 	break;
-		// }
 		default: {
 			result.type = HUSH_LEXEME_TYPE_FILE_REDIRECT;
 			char *begin = buffer->cursor;
@@ -114,7 +373,7 @@ Lexeme get_next_lexeme(Buffer *buffer)
 				char *input_fd_str = (char *) malloc((input_fd_len + 1) * sizeof (char));
 				if (input_fd_str == NULL) {
 					fprintf(stderr, "hush: couldn't allocate memory to 'input_fd_str`\n");
-					result.type = HUSH_LEXEME_TYPE_END_OF_BUFFER;
+					result.type = HUSH_LEXEME_TYPE_ERROR;
 					return result;
 				}
 				input_fd_str[input_fd_len] = '\0';
@@ -134,10 +393,14 @@ Lexeme get_next_lexeme(Buffer *buffer)
 						result.file_redirect.input_fd = STDOUT_FILENO;
 					}
 					if (buffer->cursor == buffer->end) {
-						fprintf(stderr, "hush: parse error after '%s'\n", get_file_redirect_mode_string(result.file_redirect.mode));
-						result.type = HUSH_LEXEME_TYPE_END_OF_BUFFER;
+						fprintf(get_parse_errors(), "hush: parse error after '%s'\n", get_file_redirect_mode_string(result.file_redirect.mode));
+						result.type = HUSH_LEXEME_TYPE_ERROR;
 						return result;
 					}
+					if (*buffer->cursor == '<' && result.file_redirect.mode == O_RDONLY) {
+						++buffer->cursor;
+						return get_here_document(buffer, result);
+					}
 					if (*buffer->cursor == '>') {
 						++buffer->cursor;
 						if (result.file_redirect.mode == O_WRONLY) {
@@ -147,19 +410,18 @@ Lexeme get_next_lexeme(Buffer *buffer)
 						}
 					}
 					if (buffer->cursor == buffer->end) {
-						fprintf(stderr, "hush: parse error after '%s`\n", get_file_redirect_mode_string(result.file_redirect.mode));
-						result.type = HUSH_LEXEME_TYPE_END_OF_BUFFER;
+						fprintf(get_parse_errors(), "hush: parse error after '%s`\n", get_file_redirect_mode_string(result.file_redirect.mode));
+						result.type = HUSH_LEXEME_TYPE_ERROR;
 						return result;
 					}
 
-					// TODO: Add string ('"` and ''`) lexing here
 					if (*buffer->cursor == '&') {
 						begin = ++buffer->cursor;
 						for (; buffer->cursor < buffer->end && isdigit(*buffer->cursor); ++buffer->cursor);
 						if (buffer->cursor == begin || *buffer->cursor == '<' || *buffer->cursor == '>' || \
-								!(buffer->cursor == buffer->end || is_lexeme_term(*buffer->cursor))) {
-							fprintf(stderr, "hush: parse error after '%s&`\n", get_file_redirect_mode_string(result.file_redirect.mode));
-							result.type = HUSH_LEXEME_TYPE_END_OF_BUFFER;
+								!(buffer->cursor == buffer->end || is_word_end(buffer->cursor, buffer->end))) {
+							fprintf(get_parse_errors(), "hush: parse error after '%s&`\n", get_file_redirect_mode_string(result.file_redirect.mode));
+							result.type = HUSH_LEXEME_TYPE_ERROR;
 							return result;
 						}
 						size_t output_fd_len = buffer->cursor - begin;
@@ -170,10 +432,10 @@ Lexeme get_next_lexeme(Buffer *buffer)
 						free(output_fd_str);
 						return result;
 					} else {
-						for (; buffer->cursor < buffer->end && is_wspace(*buffer->cursor); ++buffer->cursor);
-						if (buffer->cursor == buffer->end) {
-							fprintf(stderr, "hush: parse error after '%s`\n", get_file_redirect_mode_string(result.file_redirect.mode));
-							result.type = HUSH_LEXEME_TYPE_END_OF_BUFFER;
+						for (; buffer->cursor < buffer->end && is_blank(*buffer->cursor); ++buffer->cursor);
+						if (buffer->cursor == buffer->end || *buffer->cursor == '\n') {
+							fprintf(get_parse_errors(), "hush: parse error after '%s`\n", get_file_redirect_mode_string(result.file_redirect.mode));
+							result.type = HUSH_LEXEME_TYPE_ERROR;
 							return result;
 						}
 						begin = buffer->cursor;
@@ -186,13 +448,16 @@ Lexeme get_next_lexeme(Buffer *buffer)
 				}
 			}
 
-			// TODO: String lexing here as well
-			for (; buffer->cursor < buffer->end && !is_lexeme_term(*buffer->cursor); ++buffer->cursor);
+			char missing = skip_word(buffer, true);
+			if (missing != '\0') {
+				return report_open_word(result, missing);
+			}
 
-			// Find the most efficient way to allocate memory to the lexeme content
+			// Find the most efficient way to allocate memory to the lexeme content,
+			// a newline is left for the next lexeme
 			if (buffer->cursor == buffer->end) {
 				result.content = begin;
-			} else if (is_wspace(*buffer->cursor)) {
+			} else if (is_blank(*buffer->cursor)) {
 				*(buffer->cursor++) = '\0';
 				result.content = begin;
 			} else {
@@ -200,7 +465,7 @@ Lexeme get_next_lexeme(Buffer *buffer)
 				result.content = (char *) malloc((content_len + 1) * sizeof (char));
 				if (result.content == NULL) {
 					fprintf(stderr, "hush: unable to allocate memory\n");
-					result.type = HUSH_LEXEME_TYPE_END_OF_BUFFER;
+					result.type = HUSH_LEXEME_TYPE_ERROR;
 					return result;
 				}
 				strncpy(result.content, begin, content_len);
@@ -208,19 +473,83 @@ Lexeme get_next_lexeme(Buffer *buffer)
 			}
 			
 			if (result.type == HUSH_LEXEME_TYPE_FILE_REDIRECT) {
-				if ((result.file_redirect.output_fd = open(result.content, result.file_redirect.mode)) == -1) {
-					fprintf(stderr, "hush: file '%s` cannot be opened\n", result.content);
-					result.type = HUSH_LEXEME_TYPE_END_OF_BUFFER;
-					return result;
-				}
+				result.file_redirect.output_fd = -1;
+				result.file_redirect.word = result.content;
+			}
+		}
+	}
+	return result;
+}
 
-				// Free the content if it was allocated
-				if (result.content < buffer->text || result.content > buffer->end) {
-					free(result.content);
-					result.content = NULL;
-				}
+// Follows the same rules as get_next_lexeme() but only finds where the lexeme
+// is, the buffer isn't written to and here-documents aren't read
+Lexeme_Span scan_next_lexeme(Buffer *buffer)
+{
+	Lexeme_Span result = {0};
+	for (; buffer->cursor < buffer->end && is_blank(*buffer->cursor); ++buffer->cursor);
+	if (buffer->cursor < buffer->end && *buffer->cursor == '#') {
+		for (; buffer->cursor < buffer->end && *buffer->cursor != '\n'; ++buffer->cursor);
+	}
+	result.begin = result.end = buffer->cursor - buffer->text;
+	if (buffer->cursor == buffer->end) {
+		result.type = HUSH_LEXEME_TYPE_END_OF_BUFFER;
+		return result;
+	}
+
+	if (buffer->cursor + 1 < buffer->end && (*buffer->cursor == '&' || *buffer->cursor == '|') && \
+			*(buffer->cursor + 1) == *buffer->cursor) {
+		result.type = HUSH_LEXEME_TYPE_END_OF_COMMAND;
+		buffer->cursor += 2;
+	} else if (*buffer->cursor == '|' || *buffer->cursor == ';' || *buffer->cursor == '\n') {
+		result.type = HUSH_LEXEME_TYPE_END_OF_COMMAND;
+		++buffer->cursor;
+	} else {
+		char *begin = buffer->cursor;
+		for (; buffer->cursor < buffer->end && isdigit(*buffer->cursor); ++buffer->cursor);
+		if (buffer->cursor == buffer->end || (*buffer->cursor != '<' && *buffer->cursor != '>')) {
+			result.type = HUSH_LEXEME_TYPE_ARGUMENT;
+			buffer->cursor = begin;
+			result.is_open = skip_word(buffer, false) != '\0';
+			result.end = buffer->cursor - buffer->text;
+			return result;
+		}
+
+		// '<<`, '<<-` and '<<<`, or '>>` and '<>`
+		result.type = HUSH_LEXEME_TYPE_FILE_REDIRECT;
+		if (*buffer->cursor++ == '<' && buffer->cursor < buffer->end && *buffer->cursor == '<') {
+			++buffer->cursor;
+			if (buffer->cursor < buffer->end && (*buffer->cursor == '<' || *buffer->cursor == '-')) {
+				++buffer->cursor;
+			}
+		} else if (buffer->cursor < buffer->end && *buffer->cursor == '>') {
+			++buffer->cursor;
+		}
+		if (buffer->cursor < buffer->end && *buffer->cursor == '&') {
+			for (++buffer->cursor; buffer->cursor < buffer->end && isdigit(*buffer->cursor); ++buffer->cursor);
+		} else {
+
+			// The word is part of the redirect, unless there isn't one yet
+			char *operator_end = buffer->cursor;
+			for (; buffer->cursor < buffer->end && is_blank(*buffer->cursor); ++buffer->cursor);
+			if (buffer->cursor == buffer->end || is_word_end(buffer->cursor, buffer->end)) {
+				buffer->cursor = operator_end;
+			} else {
+				result.is_open = skip_word(buffer, false) != '\0';
 			}
 		}
 	}
+	result.end = buffer->cursor - buffer->text;
 	return result;
 }
+
+// Whether the rest of the buffer ends inside a quote or substitution, which
+// the lines after it could still close
+bool is_left_open(Buffer *buffer)
+{
+	Buffer rest = *buffer;
+	Lexeme_Span span;
+	do {
+		span = scan_next_lexeme(&rest);
+	} while (span.type != HUSH_LEXEME_TYPE_END_OF_BUFFER && !span.is_open);
+	return span.is_open;
+}
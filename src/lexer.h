@@ -4,14 +4,21 @@
 typedef enum {
 	HUSH_LEXEME_TYPE_ARGUMENT = 0,
 	HUSH_LEXEME_TYPE_FILE_REDIRECT,
-	HUSH_LEXEME_TYPE_END_OF_COMMAND, // ';' and '|' lexemes
+	HUSH_LEXEME_TYPE_END_OF_COMMAND, // ';', '|', '&&', '||' and newline lexemes
 	HUSH_LEXEME_TYPE_END_OF_BUFFER,
+	HUSH_LEXEME_TYPE_ERROR, // Already reported, nothing after it can be trusted
 } Hush_Lexeme_Type;
 
+// Files and here-documents are only opened when the command runs, so the
+// same parsed command can be run more than once
 typedef struct {
 	int input_fd;
-	int output_fd;
+	int output_fd; // -1 unless given directly with '>&N`
 	int mode;
+	char *word; // File to open, expanded when the command runs
+	char *here_document;
+	size_t here_document_len;
+	bool is_here_string; // The here-document still needs expanding
 } File_Redirect;
 
 typedef struct {
@@ -20,7 +27,21 @@ typedef struct {
 	File_Redirect file_redirect;
 } Lexeme;
 
+// Where a lexeme is in the buffer, as offsets from the start of its text
+typedef struct {
+	Hush_Lexeme_Type type;
+	size_t begin;
+	size_t end;
+	bool is_open; // Runs to the end of the buffer inside a quote or substitution
+} Lexeme_Span;
+
+void set_parse_errors(FILE *file);
+FILE *get_parse_errors(void);
+bool take_deferred_input(void);
 void print_lexeme(Lexeme lexeme);
+char *find_substitution_end(char *begin, char *end);
 Lexeme get_next_lexeme(Buffer *buffer);
+Lexeme_Span scan_next_lexeme(Buffer *buffer);
+bool is_left_open(Buffer *buffer);
 
 #endif // LEXER_H_
@@ -1,40 +1,155 @@
+#include <fcntl.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "buffer.h"
 #include "lexer.h"
+#include "arena.h"
 #include "parser.h"
+#include "builtin.h"
+#include "dirs.h"
+#include "exec.h"
+#include "fds.h"
+#include "script.h"
+#include "server.h"
+#include "trace.h"
+#include "vars.h"
 
-int main(void)
+extern char **environ;
+
+int main(int argc, char **argv)
 {
-	init_terminal();
-	init_history();
+	// Each step before the first prompt is timed and reported on exit
+	if (argc > 1 && strcmp(argv[1], "--startup-profile") == 0) {
+		start_startup_profile();
+		argv[1] = argv[0];
+		++argv;
+		--argc;
+	}
+
+	// A client hands the rest of its arguments over to a server, or runs
+	// them itself if there isn't one
+	if (argc > 2 && strcmp(argv[1], "--client") == 0) {
+		char *socket_path = argv[2];
+		argv[2] = argv[0];
+		argv += 2;
+		argc -= 2;
+		int status = send_request(socket_path, argv);
+		if (status != -1) {
+			return status;
+		}
+	}
+
+	unsigned long long profile_begin = profile_now();
+	init_vars(environ);
+	profile_phase("vars", profile_begin);
 
-	while (true) {
+	// Only the server's children get past this, each with its client's arguments
+	bool is_served = false;
+	if (argc > 2 && strcmp(argv[1], "--server") == 0) {
+		if ((argv = serve_requests(argv[2])) == NULL) {
+			return 1;
+		}
+		for (argc = 0; argv[argc] != NULL; ++argc);
+		is_served = true;
+	}
+
+	// Tracing can also be turned on later with 'set -o trace`
+	char *trace_path = getenv("HUSH_TRACE");
+	if (trace_path != NULL && *trace_path != '\0') {
+		trace_start(trace_path);
+	}
+
+	// Scripts are given as a file or piped in, otherwise hush is interactive.
+	// Piped ones aren't parsed ahead since what's run may read from the same
+	// input.
+	bool is_interactive = false;
+	bool should_parse_ahead = false;
+	if (argc > 2 && strcmp(argv[1], "-c") == 0) {
+		FILE *script = fmemopen(argv[2], strlen(argv[2]), "r");
+		if (script == NULL) {
+			fprintf(stderr, "hush: unable to read commands from '-c`\n");
+			return 127;
+		}
+		init_script(script);
+		set_positional_args((argc > 3) ? argv + 3 : argv);
+		should_parse_ahead = true;
+	} else if (argc > 1) {
+		int script_fd = keep_fd(open_fd(argv[1], O_RDONLY, 0));
+		FILE *script = (script_fd == -1) ? NULL : fdopen(script_fd, "r");
+		if (script == NULL) {
+			fprintf(stderr, "hush: unable to open script '%s`\n", argv[1]);
+			return 127;
+		}
+		init_script(script);
+		set_positional_args(argv + 1);
+		should_parse_ahead = true;
+	} else if (!isatty(STDIN_FILENO) || is_served) {
+		init_script(stdin);
+		set_positional_args(argv);
+	} else {
+		is_interactive = true;
+		set_positional_args(argv);
+	}
+
+	if (is_interactive) {
+		profile_begin = profile_now();
+		init_terminal();
+		profile_phase("terminal", profile_begin);
+		profile_begin = profile_now();
+		init_history();
+		profile_phase("history", profile_begin);
+		profile_begin = profile_now();
+		init_dirs(NULL);
+		profile_phase("dirs", profile_begin);
+
+		// Only the foreground children should be interrupted
+		signal(SIGINT, SIG_IGN);
+		signal(SIGQUIT, SIG_IGN);
+	}
+
+	if (should_parse_ahead) {
+		run_script();
+	}
+	while (!exit_requested && !should_parse_ahead) {
 		
 		// Get the next buffer from the user
+		unsigned long long trace_begin = trace_now();
 		Buffer *buffer = get_next_buffer();
 		if (buffer == NULL) {
 			break;
 		}
+		trace_record(HUSH_TRACE_INPUT, trace_begin, buffer->text);
 		// printf("BUFFER: '%s`\n", buffer->text);
 
-		// Parse the commands based on the buffer
-		Command command = get_next_command(buffer);
-		while (command.name != NULL) {
-			print_command(command);
-			command = get_next_command(buffer);
+		// Parse and run the commands based on the buffer
+		if (is_interactive) {
+			release_terminal();
+		}
+		trace_begin = trace_now();
+		run_buffer(buffer);
+		trace_record(HUSH_TRACE_LINE, trace_begin, NULL);
+		if (is_interactive) {
+			finish_history_entry();
+			init_terminal();
 		}
 	}
 
+	trace_stop();
+	if (!is_interactive) {
+		report_startup_profile();
+		return exit_requested ? exit_status : last_status;
+	}
 	release_terminal();
-	release_history();
 
-	return 0;
-}
+	// Like zsh's extended history, entries are saved with when they ran and
+	// for how long if HISTTIMEFORMAT is set
+	release_history(get_var("HISTTIMEFORMAT", 14) != NULL);
+	report_startup_profile();
 
-// TODO: Implement strings
-/* TODO: GLOBBING
-	Here's how it would work: you'd only need to look at the arguments since commands and options can't have the '*' in them. So, you find if an argument has the star. If it does, you pass it to a function that locates all the files in your directory and creates a linked list of Hush_Args that it returns that contains all those files! This linked list is then appended to your list of args no problem! Globbing actually isn't too bad. The only hard part would be the making of a function that can create that linked list...but that's for future Trent to figure out
-*/
+	return exit_requested ? exit_status : last_status;
+}
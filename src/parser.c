@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <ctype.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -6,7 +7,9 @@
 
 #include "buffer.h"
 #include "lexer.h"
+#include "arena.h"
 #include "parser.h"
+#include "trace.h"
 
 typedef struct Array_LL Array_LL;
 struct Array_LL {
@@ -14,7 +17,7 @@ struct Array_LL {
 	Array_LL *next;
 };
 
-static bool fr_equals_zero(File_Redirect fr)
+bool fr_equals_zero(File_Redirect fr)
 {
 	return fr.input_fd == 0 && fr.output_fd == 0 && fr.mode == 0;
 }
@@ -39,15 +42,113 @@ void print_command(Command command)
 	printf("Pipeline: %s\n\n", command.has_pipe ? "true" : "false");
 }
 
-Command get_next_command(Buffer *buffer)
+static char **copy_words(Arena *arena, char **words)
+{
+	size_t num_words = 0;
+	for (; words[num_words] != NULL; ++num_words);
+	char **copy = (char **) arena_alloc(arena, (num_words + 1) * sizeof (char *));
+	for (size_t i = 0; i < num_words; ++i) {
+		copy[i] = arena_strdup(arena, words[i]);
+	}
+	copy[num_words] = NULL;
+	return copy;
+}
+
+static File_Redirect *copy_redirects(Arena *arena, File_Redirect *redirects)
+{
+	if (redirects == NULL) {
+		return NULL;
+	}
+	size_t num_frs = 0;
+	for (; !fr_equals_zero(redirects[num_frs]); ++num_frs);
+	File_Redirect *copy = (File_Redirect *) arena_alloc(arena, (num_frs + 1) * sizeof (File_Redirect));
+	for (size_t i = 0; i < num_frs; ++i) {
+		File_Redirect fr = redirects[i];
+		if (fr.word != NULL) {
+			fr.word = arena_strdup(arena, fr.word);
+		}
+		if (fr.here_document != NULL) {
+			fr.here_document = (char *) arena_alloc(arena, (fr.here_document_len + 1) * sizeof (char));
+			memcpy(fr.here_document, redirects[i].here_document, fr.here_document_len);
+			fr.here_document[fr.here_document_len] = '\0';
+		}
+		copy[i] = fr;
+	}
+	File_Redirect fr_struct_zero = {0};
+	copy[num_frs] = fr_struct_zero;
+	return copy;
+}
+
+// Commands point into the buffer they were parsed from, this makes a copy
+// that can be kept around after the buffer is reused
+Command copy_command(Arena *arena, Command command)
+{
+	Command copy = command;
+	copy.args = copy_words(arena, command.args);
+	copy.name = copy.args[0];
+	copy.redirects = copy_redirects(arena, command.redirects);
+	return copy;
+}
+
+Node *copy_node(Arena *arena, Node *node)
+{
+	Node *result = NULL, **tail = &result;
+	for (; node != NULL; node = node->next) {
+		Node *copy = (Node *) arena_alloc(arena, sizeof (Node));
+		*copy = *node;
+		copy->redirects = copy_redirects(arena, node->redirects);
+		if (node->commands != NULL) {
+			copy->commands = (Command *) arena_alloc(arena, node->count * sizeof (Command));
+			for (size_t i = 0; i < node->count; ++i) {
+				copy->commands[i] = copy_command(arena, node->commands[i]);
+			}
+		}
+		copy->condition = copy_node(arena, node->condition);
+		copy->body = copy_node(arena, node->body);
+		copy->else_body = copy_node(arena, node->else_body);
+		copy->name = (node->name == NULL) ? NULL : arena_strdup(arena, node->name);
+		copy->words = (node->words == NULL) ? NULL : copy_words(arena, node->words);
+		copy->next = NULL;
+		*tail = copy;
+		tail = &copy->next;
+	}
+	return result;
+}
+
+static void free_array_ll(Array_LL *list, bool should_free_content)
+{
+	while (list != NULL) {
+		Array_LL *next = list->next;
+		if (should_free_content) {
+			free(list->content);
+		}
+		free(list);
+		list = next;
+	}
+}
+
+// The name is NULL at the end of the buffer, and also when the command
+// couldn't be lexed, which sets is_failed
+Command get_next_command(Buffer *buffer, bool *is_failed)
 {
 	Command command = {0};
+	*is_failed = false;
 	Lexeme lexeme = get_next_lexeme(buffer);
+
+	// Blank lines between the commands of a multi-line buffer
+	while (lexeme.type == HUSH_LEXEME_TYPE_END_OF_COMMAND && *lexeme.content == '\n') {
+		lexeme = get_next_lexeme(buffer);
+	}
 	if (lexeme.type == HUSH_LEXEME_TYPE_END_OF_BUFFER) {
 		return command;
 	}
+	if (lexeme.type == HUSH_LEXEME_TYPE_ERROR) {
+		*is_failed = true;
+		return command;
+	}
 	if (lexeme.type == HUSH_LEXEME_TYPE_END_OF_COMMAND) {
-		fprintf(stderr, "hush: parse error near '%s`\n", lexeme.content);
+		fprintf(get_parse_errors(), "hush: parse error near '%s`\n", lexeme.content);
+		*is_failed = true;
 		return command;
 	}
 
@@ -87,11 +188,25 @@ Command get_next_command(Buffer *buffer)
 			case HUSH_LEXEME_TYPE_END_OF_COMMAND: {
 				if (strcmp(lexeme.content, "|") == 0) {
 					command.has_pipe = true;
+				} else if (strcmp(lexeme.content, "&&") == 0) {
+					command.connector = HUSH_CONNECTOR_AND;
+				} else if (strcmp(lexeme.content, "||") == 0) {
+					command.connector = HUSH_CONNECTOR_OR;
 				}
 			}
 			case HUSH_LEXEME_TYPE_END_OF_BUFFER: {
 				break;
 			}
+			case HUSH_LEXEME_TYPE_ERROR: {
+				for (Array_LL *node = frs_ll; node != NULL; node = node->next) {
+					free(((File_Redirect *) node->content)->here_document);
+				}
+				free_array_ll(args_ll, false);
+				free_array_ll(frs_ll, true);
+				*is_failed = true;
+				Command command_struct_zero = {0};
+				return command_struct_zero;
+			}
 			default: {
 				assert(false && "Unreachable");
 			}
@@ -114,5 +229,488 @@ Command get_next_command(Buffer *buffer)
 		File_Redirect fr_struct_zero = {0};
 		command.redirects[num_frs] = fr_struct_zero;
 	}
+	free_array_ll(args_ll, false);
+	free_array_ll(frs_ll, true);
+	return command;
+}
+
+// Lines read to finish an open compound command, quote or substitution, or
+// a command that ended with '|`, '&&` or '||`
+static _Thread_local Buffer continuation;
+
+typedef struct {
+	Buffer **buffer;
+	Arena *arena;
+	bool may_continue;
+	Command pending; // Put back to be read again by next_command
+	bool has_pending;
+	size_t depth; // Compound commands still waiting for their closing keyword
+	bool is_incomplete; // The last command ended with '|`, '&&` or '||`
+	bool failed;
+} Parser;
+
+static bool parse_error(Parser *parser, char *near)
+{
+	fprintf(get_parse_errors(), "hush: parse error near '%s`\n", near);
+	parser->failed = true;
+	return false;
+}
+
+// The input also ends early when a command couldn't be lexed, which has
+// already been reported
+static bool unexpected_end(Parser *parser)
+{
+	if (!parser->failed) {
+		fprintf(get_parse_errors(), "hush: unexpected end of input\n");
+		parser->failed = true;
+	}
+	return false;
+}
+
+static bool read_continuation(Parser *parser)
+{
+	if (!parser->may_continue || (parser->depth == 0 && !parser->is_incomplete)) {
+		return false;
+	}
+	unsigned long long trace_begin = trace_now();
+	char *line = get_next_line("> ");
+	trace_record(HUSH_TRACE_INPUT, trace_begin, line);
+	if (line == NULL) {
+		return false;
+	}
+	set_buffer(&continuation, line, strlen(line));
+	*parser->buffer = &continuation;
+	return true;
+}
+
+// A quote or substitution left open at the end of a line carries on onto the
+// next, which is joined on after a newline
+static void read_open_lines(Parser *parser)
+{
+	while (parser->may_continue && is_left_open(*parser->buffer)) {
+		unsigned long long trace_begin = trace_now();
+		char *line = get_next_line("> ");
+		trace_record(HUSH_TRACE_INPUT, trace_begin, line);
+		if (line == NULL) {
+			return;
+		}
+		Buffer *buffer = *parser->buffer;
+		size_t rest_len = buffer->end - buffer->cursor, line_len = strlen(line);
+		char *joined = (char *) malloc((rest_len + line_len + 1) * sizeof (char));
+		if (joined == NULL) {
+			fprintf(stderr, "hush: unable to allocate memory\n");
+			exit(EXIT_FAILURE);
+		}
+		memcpy(joined, buffer->cursor, rest_len);
+		joined[rest_len] = '\n';
+		memcpy(joined + rest_len + 1, line, line_len);
+		set_buffer(&continuation, joined, rest_len + line_len + 1);
+		free(joined);
+		*parser->buffer = &continuation;
+	}
+}
+
+static Command lex_command(Parser *parser, bool *is_failed)
+{
+	read_open_lines(parser);
+	unsigned long long trace_begin = trace_now();
+	Command raw = get_next_command(*parser->buffer, is_failed);
+	trace_record(HUSH_TRACE_LEX, trace_begin, raw.name);
+	return raw;
+}
+
+// Commands are copied into the arena straight away since the buffer they
+// point into is overwritten by the next continuation line. The name is NULL
+// once the input runs out, or when lexing failed and the rest of the line
+// was dropped.
+static Command next_command(Parser *parser)
+{
+	if (parser->has_pending) {
+		parser->has_pending = false;
+		return parser->pending;
+	}
+	bool is_failed;
+	Command raw = lex_command(parser, &is_failed);
+	while (raw.name == NULL && !is_failed && read_continuation(parser)) {
+		raw = lex_command(parser, &is_failed);
+	}
+	if (is_failed) {
+		(*parser->buffer)->cursor = (*parser->buffer)->end;
+		parser->failed = true;
+	}
+	if (raw.name == NULL) {
+		return raw;
+	}
+	Command command = copy_command(parser->arena, raw);
+	free(raw.args);
+	if (raw.redirects != NULL) {
+		for (size_t i = 0; !fr_equals_zero(raw.redirects[i]); ++i) {
+			free(raw.redirects[i].here_document);
+		}
+		free(raw.redirects);
+	}
+	parser->is_incomplete = command.has_pipe || command.connector != HUSH_CONNECTOR_NONE;
 	return command;
 }
+
+static void put_back(Parser *parser, Command command)
+{
+	parser->pending = command;
+	parser->has_pending = true;
+}
+
+// Anything after a keyword on the same line is a command of its own
+static bool put_back_rest(Parser *parser, Command command, size_t skip)
+{
+	if (command.args[skip] == NULL) {
+		if (command.redirects != NULL || command.has_pipe || command.connector != HUSH_CONNECTOR_NONE) {
+			return parse_error(parser, command.name);
+		}
+		return true;
+	}
+	command.args += skip;
+	command.name = command.args[0];
+	put_back(parser, command);
+	return true;
+}
+
+static bool is_one_of(char *word, char **words)
+{
+	for (; *words != NULL; ++words) {
+		if (strcmp(word, *words) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static char *opening_keywords[] = {"if", "while", "until", "for", "{", NULL};
+static char *closing_keywords[] = {"then", "elif", "else", "fi", "do", "done", "}", NULL};
+
+static Node *new_node(Parser *parser, Hush_Node_Type type)
+{
+	Node *node = (Node *) arena_alloc(parser->arena, sizeof (Node));
+	Node node_struct_zero = {0};
+	*node = node_struct_zero;
+	node->type = type;
+	return node;
+}
+
+static Node *parse_list(Parser *parser, char **terminators);
+
+// Reads the keyword that has to come next
+static bool expect(Parser *parser, char *keyword)
+{
+	Command command = next_command(parser);
+	if (command.name == NULL) {
+		return unexpected_end(parser);
+	}
+	if (strcmp(command.name, keyword) != 0) {
+		return parse_error(parser, command.name);
+	}
+	return put_back_rest(parser, command, 1);
+}
+
+// The closing keyword carries the redirects and connector of the whole
+// compound command
+static bool finish_compound(Parser *parser, Node *node, Command closer)
+{
+	if (closer.args[1] != NULL) {
+		return parse_error(parser, closer.args[1]);
+	}
+	if (closer.has_pipe) {
+		fprintf(get_parse_errors(), "hush: compound commands can't be piped\n");
+		parser->failed = true;
+		return false;
+	}
+	node->redirects = closer.redirects;
+	node->connector = closer.connector;
+	--parser->depth;
+	return true;
+}
+
+static Node *parse_if(Parser *parser, Command command)
+{
+	Node *node = new_node(parser, HUSH_NODE_TYPE_IF);
+	++parser->depth;
+	if (!put_back_rest(parser, command, 1)) {
+		return NULL;
+	}
+	node->condition = parse_list(parser, (char *[]) {"then", NULL});
+	if (parser->failed || !expect(parser, "then")) {
+		return NULL;
+	}
+	node->body = parse_list(parser, (char *[]) {"elif", "else", "fi", NULL});
+	if (parser->failed) {
+		return NULL;
+	}
+	Command keyword = next_command(parser);
+
+	// An elif is an if nested in the else, which gets closed by the same 'fi`
+	if (strcmp(keyword.name, "elif") == 0) {
+		node->else_body = parse_if(parser, keyword);
+		if (node->else_body == NULL) {
+			return NULL;
+		}
+		node->redirects = node->else_body->redirects;
+		node->connector = node->else_body->connector;
+		node->else_body->redirects = NULL;
+		node->else_body->connector = HUSH_CONNECTOR_NONE;
+		--parser->depth;
+		return node;
+	}
+	if (strcmp(keyword.name, "else") == 0) {
+		if (!put_back_rest(parser, keyword, 1)) {
+			return NULL;
+		}
+		node->else_body = parse_list(parser, (char *[]) {"fi", NULL});
+		if (parser->failed) {
+			return NULL;
+		}
+		keyword = next_command(parser);
+	}
+	return finish_compound(parser, node, keyword) ? node : NULL;
+}
+
+static bool parse_loop_body(Parser *parser, Node *node)
+{
+	if (!expect(parser, "do")) {
+		return false;
+	}
+	node->body = parse_list(parser, (char *[]) {"done", NULL});
+	if (parser->failed) {
+		return false;
+	}
+	return finish_compound(parser, node, next_command(parser));
+}
+
+static Node *parse_while(Parser *parser, Command command)
+{
+	Node *node = new_node(parser, (strcmp(command.name, "while") == 0) ? HUSH_NODE_TYPE_WHILE : HUSH_NODE_TYPE_UNTIL);
+	++parser->depth;
+	if (!put_back_rest(parser, command, 1)) {
+		return NULL;
+	}
+	node->condition = parse_list(parser, (char *[]) {"do", NULL});
+	if (parser->failed || !parse_loop_body(parser, node)) {
+		return NULL;
+	}
+	return node;
+}
+
+static bool is_name(char *word)
+{
+	if (!isalpha(*word) && *word != '_') {
+		return false;
+	}
+	for (; isalnum(*word) || *word == '_'; ++word);
+	return *word == '\0';
+}
+
+// The words are kept as they were typed and only expanded when the loop runs
+static Node *parse_for(Parser *parser, Command command)
+{
+	Node *node = new_node(parser, HUSH_NODE_TYPE_FOR);
+	++parser->depth;
+	if (command.args[1] == NULL || !is_name(command.args[1])) {
+		parse_error(parser, (command.args[1] == NULL) ? command.name : command.args[1]);
+		return NULL;
+	}
+	if (command.args[2] != NULL && strcmp(command.args[2], "in") != 0) {
+		parse_error(parser, command.args[2]);
+		return NULL;
+	}
+	if (command.redirects != NULL || command.has_pipe || command.connector != HUSH_CONNECTOR_NONE) {
+		parse_error(parser, command.name);
+		return NULL;
+	}
+	node->name = command.args[1];
+	node->words = (command.args[2] == NULL) ? NULL : command.args + 3;
+	return parse_loop_body(parser, node) ? node : NULL;
+}
+
+static Node *parse_group(Parser *parser, Command command)
+{
+	Node *node = new_node(parser, HUSH_NODE_TYPE_GROUP);
+	++parser->depth;
+	if (!put_back_rest(parser, command, 1)) {
+		return NULL;
+	}
+	node->body = parse_list(parser, (char *[]) {"}", NULL});
+	if (parser->failed || !finish_compound(parser, node, next_command(parser))) {
+		return NULL;
+	}
+	return node;
+}
+
+// 'name() { ...` or 'name () { ...`, returns where the body starts in the
+// arguments or 0 if the command isn't a function definition
+static size_t get_function_body_start(Command command)
+{
+	size_t name_len = strlen(command.name), body_start;
+	if (name_len > 2 && strcmp(command.name + name_len - 2, "()") == 0) {
+		body_start = 1;
+	} else if (command.args[1] != NULL && strcmp(command.args[1], "()") == 0) {
+		body_start = 2;
+	} else {
+		return 0;
+	}
+	if (command.args[body_start] == NULL || strcmp(command.args[body_start], "{") != 0) {
+		return 0;
+	}
+	return body_start + 1;
+}
+
+// The body of a function is a group, so redirects after its closing '}` are
+// applied every time it's called
+static Node *parse_function(Parser *parser, Command command, size_t body_start)
+{
+	Node *node = new_node(parser, HUSH_NODE_TYPE_FUNCTION);
+	size_t name_len = (body_start == 2) ? strlen(command.name) - 2 : strlen(command.name);
+	node->name = (char *) arena_alloc(parser->arena, (name_len + 1) * sizeof (char));
+	memcpy(node->name, command.name, name_len);
+	node->name[name_len] = '\0';
+
+	Command group = command;
+	group.args += body_start - 1;
+	group.name = group.args[0];
+	node->body = parse_group(parser, group);
+	if (node->body == NULL) {
+		return NULL;
+	}
+	node->connector = node->body->connector;
+	node->body->connector = HUSH_CONNECTOR_NONE;
+	return node;
+}
+
+static Node *parse_pipeline(Parser *parser, Command command)
+{
+	size_t count = 1, cap = 4;
+	Command *commands = (Command *) arena_alloc(parser->arena, cap * sizeof (Command));
+	commands[0] = command;
+	while (commands[count - 1].has_pipe) {
+		Command next = next_command(parser);
+		if (next.name == NULL) {
+			unexpected_end(parser);
+			return NULL;
+		}
+		if (is_one_of(next.name, opening_keywords) || is_one_of(next.name, closing_keywords)) {
+			fprintf(get_parse_errors(), "hush: compound commands can't be piped\n");
+			parser->failed = true;
+			return NULL;
+		}
+		if (count == cap) {
+			Command *grown = (Command *) arena_alloc(parser->arena, 2 * cap * sizeof (Command));
+			memcpy(grown, commands, cap * sizeof (Command));
+			commands = grown;
+			cap *= 2;
+		}
+		commands[count++] = next;
+	}
+	Node *node = new_node(parser, HUSH_NODE_TYPE_PIPELINE);
+	node->commands = commands;
+	node->count = count;
+	node->connector = commands[count - 1].connector;
+	return node;
+}
+
+static Node *parse_command(Parser *parser, Command command);
+
+// 'time` applies to the whole pipeline or compound command after it, and
+// on its own times nothing
+static Node *parse_timed(Parser *parser, Command command)
+{
+	Node *node;
+	if (command.args[1] == NULL) {
+		if (command.has_pipe) {
+			parse_error(parser, "|");
+			return NULL;
+		}
+		node = new_node(parser, HUSH_NODE_TYPE_GROUP);
+		node->connector = command.connector;
+	} else {
+		++command.args;
+		command.name = command.args[0];
+		node = parse_command(parser, command);
+		if (node == NULL) {
+			return NULL;
+		}
+	}
+	node->is_timed = true;
+	return node;
+}
+
+static Node *parse_command(Parser *parser, Command command)
+{
+	if (strcmp(command.name, "time") == 0) {
+		return parse_timed(parser, command);
+	}
+	if (strcmp(command.name, "if") == 0) {
+		return parse_if(parser, command);
+	}
+	if (strcmp(command.name, "while") == 0 || strcmp(command.name, "until") == 0) {
+		return parse_while(parser, command);
+	}
+	if (strcmp(command.name, "for") == 0) {
+		return parse_for(parser, command);
+	}
+	if (strcmp(command.name, "{") == 0) {
+		return parse_group(parser, command);
+	}
+	if (is_one_of(command.name, closing_keywords)) {
+		parse_error(parser, command.name);
+		return NULL;
+	}
+	size_t body_start = get_function_body_start(command);
+	if (body_start > 0) {
+		return parse_function(parser, command, body_start);
+	}
+	return parse_pipeline(parser, command);
+}
+
+// Parses up to one of the terminators, which is left to be read next. With
+// no terminators this stops at the end of the first '&&`/'||` chain.
+static Node *parse_list(Parser *parser, char **terminators)
+{
+	Node *list = NULL, **tail = &list;
+	while (!parser->failed) {
+		Command command = next_command(parser);
+		if (command.name == NULL) {
+			if (terminators != NULL || parser->is_incomplete) {
+				unexpected_end(parser);
+			}
+			break;
+		}
+		if (terminators != NULL && is_one_of(command.name, terminators)) {
+			put_back(parser, command);
+			break;
+		}
+		Node *node = parse_command(parser, command);
+		if (node == NULL) {
+			break;
+		}
+		*tail = node;
+		tail = &node->next;
+		if (terminators == NULL && node->connector == HUSH_CONNECTOR_NONE) {
+			break;
+		}
+	}
+	return parser->failed ? NULL : list;
+}
+
+// Returns the next '&&`/'||` chain of commands, or NULL at the end of the
+// input or when parsing failed, which sets is_failed. When may_continue is
+// set, unfinished commands carry on onto lines read with get_next_line,
+// which also moves buffer onto those lines.
+Node *get_next_node(Buffer **buffer, Arena *arena, bool may_continue, bool *is_failed)
+{
+	Parser parser = {0};
+	parser.buffer = buffer;
+	parser.arena = arena;
+	parser.may_continue = may_continue;
+	unsigned long long trace_begin = trace_now();
+	Node *node = parse_list(&parser, NULL);
+	trace_record(HUSH_TRACE_PARSE, trace_begin, NULL);
+	*is_failed = parser.failed;
+	return node;
+}
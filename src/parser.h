@@ -1,14 +1,55 @@
 #ifndef PARSER_H_
 #define PARSER_H_
 
+typedef enum {
+	HUSH_CONNECTOR_NONE = 0, // ';', a newline or the end of the input
+	HUSH_CONNECTOR_AND,
+	HUSH_CONNECTOR_OR,
+} Hush_Connector;
+
 typedef struct {
 	char *name;
 	char **args;
 	File_Redirect *redirects;
 	bool has_pipe;
+	Hush_Connector connector;
 } Command;
 
+typedef enum {
+	HUSH_NODE_TYPE_PIPELINE = 0,
+	HUSH_NODE_TYPE_IF,
+	HUSH_NODE_TYPE_WHILE,
+	HUSH_NODE_TYPE_UNTIL,
+	HUSH_NODE_TYPE_FOR,
+	HUSH_NODE_TYPE_GROUP,
+	HUSH_NODE_TYPE_FUNCTION,
+} Hush_Node_Type;
+
+// Lists of nodes are linked through next, each node's connector saying
+// whether the one after it runs. Loops and functions run the same nodes
+// every time, nothing is lexed or parsed again.
+typedef struct Node Node;
+struct Node {
+	Hush_Node_Type type;
+	Hush_Connector connector;
+	Node *next;
+	File_Redirect *redirects; // Applied around a whole compound command
+
+	Command *commands; // Pipelines
+	size_t count;
+	Node *condition; // if, while and until
+	Node *body;
+	Node *else_body; // if, an elif is a nested if
+	char *name; // The for loop variable or the function name
+	char **words; // What a for loop runs over, NULL for '"$@"`
+	bool is_timed; // Preceded by 'time`
+};
+
+bool fr_equals_zero(File_Redirect fr);
 void print_command(Command command);
-Command get_next_command(Buffer *buffer);
+Command copy_command(Arena *arena, Command command);
+Node *copy_node(Arena *arena, Node *node);
+Command get_next_command(Buffer *buffer, bool *is_failed);
+Node *get_next_node(Buffer **buffer, Arena *arena, bool may_continue, bool *is_failed);
 
 #endif // PARSER_H_
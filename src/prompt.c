@@ -0,0 +1,420 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "buffer.h"
+#include "lexer.h"
+#include "arena.h"
+#include "parser.h"
+#include "exec.h"
+#include "fds.h"
+#include "prompt.h"
+#include "vars.h"
+
+#define GIT_CACHE_CAP 8
+
+// Whether a repository has uncommitted changes takes running 'git status`,
+// which can take seconds in a big one, so it's worked out on another thread
+// and remembered until the index changes
+typedef struct {
+	char *git_dir;
+	time_t index_mtime;
+	off_t index_size;
+	bool is_dirty;
+	bool is_known;
+	unsigned long last_used;
+} Git_Status;
+
+static Git_Status git_cache[GIT_CACHE_CAP];
+static unsigned long git_cache_clock = 0;
+
+// Only the latest request matters, older ones are for prompts already gone.
+// Where git is and the environment it runs in are copied when it's made,
+// since the shell's variables can change while the worker runs.
+typedef struct {
+	char *git_dir;
+	char *work_tree;
+	char *git_path;
+	char **environment;
+	time_t index_mtime;
+	off_t index_size;
+} Git_Request;
+
+static Git_Request *git_request = NULL;
+
+static pthread_mutex_t git_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t git_requested = PTHREAD_COND_INITIALIZER;
+static pthread_t git_worker;
+static bool is_worker_started = false;
+
+// The worker writes a byte here whenever a status comes in, so the editor
+// can wait on it along with the keyboard
+static int update_fds[2] = {-1, -1};
+
+static double last_duration = 0;
+
+static char *prompt = NULL;
+static size_t prompt_len = 0;
+static size_t prompt_cap = 0;
+
+void set_prompt_duration(double duration)
+{
+	last_duration = duration;
+}
+
+int get_prompt_fd(void)
+{
+	return update_fds[0];
+}
+
+bool take_prompt_update(void)
+{
+	char bytes[64];
+	bool has_update = false;
+	while (read(update_fds[0], bytes, sizeof (bytes)) > 0) {
+		has_update = true;
+	}
+	return has_update;
+}
+
+static void append_prompt(char *text, size_t len)
+{
+	if (prompt_len + len + 1 > prompt_cap) {
+		prompt_cap = (prompt_cap == 0) ? 64 : prompt_cap;
+		while (prompt_len + len + 1 > prompt_cap) {
+			prompt_cap *= 2;
+		}
+		prompt = (char *) realloc(prompt, prompt_cap * sizeof (char));
+		if (prompt == NULL) {
+			fprintf(stderr, "hush: unable to allocate memory\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	memcpy(prompt + prompt_len, text, len);
+	prompt_len += len;
+	prompt[prompt_len] = '\0';
+}
+
+static Git_Status *find_git_status(char *git_dir)
+{
+	for (size_t i = 0; i < GIT_CACHE_CAP; ++i) {
+		if (git_cache[i].git_dir != NULL && strcmp(git_cache[i].git_dir, git_dir) == 0) {
+			return &git_cache[i];
+		}
+	}
+	return NULL;
+}
+
+// Least recently used entries make way for new repositories
+static Git_Status *add_git_status(char *git_dir)
+{
+	Git_Status *oldest = &git_cache[0];
+	for (size_t i = 1; i < GIT_CACHE_CAP && oldest->git_dir != NULL; ++i) {
+		if (git_cache[i].git_dir == NULL || git_cache[i].last_used < oldest->last_used) {
+			oldest = &git_cache[i];
+		}
+	}
+	free(oldest->git_dir);
+	*oldest = (Git_Status) {0};
+	oldest->git_dir = strdup(git_dir);
+	return oldest;
+}
+
+static char **copy_environment(void)
+{
+	char **environment = get_environment();
+	size_t count = 0;
+	while (environment[count] != NULL) {
+		++count;
+	}
+	char **copy = (char **) malloc((count + 1) * sizeof (char *));
+	if (copy == NULL) {
+		fprintf(stderr, "hush: unable to allocate memory\n");
+		exit(EXIT_FAILURE);
+	}
+	for (size_t i = 0; i < count; ++i) {
+		copy[i] = strdup(environment[i]);
+	}
+	copy[count] = NULL;
+	return copy;
+}
+
+static void free_git_request(Git_Request *request)
+{
+	if (request == NULL) {
+		return;
+	}
+	for (size_t i = 0; request->environment[i] != NULL; ++i) {
+		free(request->environment[i]);
+	}
+	free(request->environment);
+	free(request->git_dir);
+	free(request->work_tree);
+	free(request->git_path);
+	free(request);
+}
+
+static bool is_git_dirty(Git_Request *request)
+{
+	int output_fds[2];
+	if (!open_pipe(output_fds)) {
+		return false;
+	}
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, output_fds[1], STDOUT_FILENO);
+	posix_spawn_file_actions_addclose(&actions, output_fds[0]);
+	posix_spawn_file_actions_addclose(&actions, output_fds[1]);
+	posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+	posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+	char *args[] = {"git", "-C", request->work_tree, "status", "--porcelain", "--ignore-submodules", NULL};
+	pid_t pid;
+	int error = posix_spawn(&pid, request->git_path, &actions, NULL, args, request->environment);
+	posix_spawn_file_actions_destroy(&actions);
+	close_fd(output_fds[1]);
+	bool is_dirty = false;
+	if (error == 0) {
+		char output[256];
+		ssize_t count;
+		while ((count = read(output_fds[0], output, sizeof (output))) > 0) {
+			is_dirty = true;
+		}
+		waitpid(pid, NULL, 0);
+	}
+	close_fd(output_fds[0]);
+	return is_dirty;
+}
+
+static void *run_git_worker(void *arg)
+{
+	(void) arg;
+	pthread_mutex_lock(&git_lock);
+	while (true) {
+		while (git_request == NULL) {
+			pthread_cond_wait(&git_requested, &git_lock);
+		}
+		Git_Request *request = git_request;
+		git_request = NULL;
+		pthread_mutex_unlock(&git_lock);
+
+		bool is_dirty = is_git_dirty(request);
+
+		pthread_mutex_lock(&git_lock);
+		Git_Status *status = find_git_status(request->git_dir);
+		if (status == NULL) {
+			status = add_git_status(request->git_dir);
+		}
+		status->index_mtime = request->index_mtime;
+		status->index_size = request->index_size;
+		status->is_dirty = is_dirty;
+		status->is_known = true;
+		free_git_request(request);
+		hold_kept_fds();
+		write(update_fds[1], "", 1);
+		release_kept_fds();
+	}
+	return NULL;
+}
+
+static bool start_git_worker(void)
+{
+	if (is_worker_started) {
+		return true;
+	}
+	if (!open_pipe(update_fds)) {
+		return false;
+	}
+	for (size_t i = 0; i < 2; ++i) {
+		update_fds[i] = keep_fd(update_fds[i]);
+		own_fd(&update_fds[i]);
+		fcntl(update_fds[i], F_SETFL, O_NONBLOCK);
+	}
+	if (pthread_create(&git_worker, NULL, run_git_worker, NULL) != 0) {
+		close_fd(update_fds[0]);
+		close_fd(update_fds[1]);
+		disown_fd(&update_fds[0]);
+		disown_fd(&update_fds[1]);
+		update_fds[0] = update_fds[1] = -1;
+		return false;
+	}
+	pthread_detach(git_worker);
+	is_worker_started = true;
+	return true;
+}
+
+// Worktrees and submodules have a '.git` file that points at the repository
+// instead, relative to the directory it's in unless it's absolute
+static bool read_git_file(char *work_tree, char *git_dir, size_t cap)
+{
+	FILE *git_file = fopen(git_dir, "re");
+	if (git_file == NULL) {
+		return false;
+	}
+	char line[PATH_MAX + 16];
+	char *prefix = "gitdir: ";
+	bool is_read = fgets(line, sizeof (line), git_file) != NULL && strncmp(line, prefix, strlen(prefix)) == 0;
+	fclose(git_file);
+	if (!is_read) {
+		return false;
+	}
+	char *path = line + strlen(prefix);
+	path[strcspn(path, "\n")] = '\0';
+	if (path[0] == '/') {
+		snprintf(git_dir, cap, "%s", path);
+	} else {
+		snprintf(git_dir, cap, "%s/%s", work_tree, path);
+	}
+	return true;
+}
+
+// The nearest '.git` above the working directory, and the work tree it's in
+static bool find_git_dir(char *cwd, char *work_tree, char *git_dir, size_t cap)
+{
+	size_t len = strlen(cwd);
+	struct stat git_stat;
+	while (true) {
+		snprintf(work_tree, cap, "%.*s", (int) len, cwd);
+		snprintf(git_dir, cap, "%s/.git", work_tree);
+		if (stat(git_dir, &git_stat) == 0 && S_ISDIR(git_stat.st_mode)) {
+			return true;
+		}
+		if (stat(git_dir, &git_stat) == 0 && S_ISREG(git_stat.st_mode) && read_git_file(work_tree, git_dir, cap)) {
+			return true;
+		}
+		while (len > 0 && cwd[len - 1] != '/') {
+			--len;
+		}
+		if (len <= 1) {
+			return false;
+		}
+		--len;
+	}
+}
+
+// The branch is read straight out of HEAD, a detached one shows its commit
+static void append_git_branch(char *git_dir)
+{
+	char path[PATH_MAX + 16], head[256];
+	snprintf(path, sizeof (path), "%s/HEAD", git_dir);
+	FILE *head_file = fopen(path, "re");
+	if (head_file == NULL) {
+		return;
+	}
+	if (fgets(head, sizeof (head), head_file) != NULL) {
+		head[strcspn(head, "\n")] = '\0';
+		char *ref = "ref: refs/heads/";
+		if (strncmp(head, ref, strlen(ref)) == 0) {
+			append_prompt(head + strlen(ref), strlen(head + strlen(ref)));
+		} else {
+			append_prompt(head, (strlen(head) < 7) ? strlen(head) : 7);
+		}
+	}
+	fclose(head_file);
+}
+
+static void append_git(char *cwd)
+{
+	char work_tree[PATH_MAX], git_dir[PATH_MAX], index_path[PATH_MAX + 16];
+	if (!find_git_dir(cwd, work_tree, git_dir, sizeof (git_dir))) {
+		return;
+	}
+	append_git_branch(git_dir);
+
+	// Until the index changes the last status still holds, otherwise the old
+	// one is shown until the new one comes in
+	struct stat index_stat = {0};
+	snprintf(index_path, sizeof (index_path), "%s/index", git_dir);
+	stat(index_path, &index_stat);
+	pthread_mutex_lock(&git_lock);
+	Git_Status *status = find_git_status(git_dir);
+	if (status != NULL) {
+		status->last_used = ++git_cache_clock;
+		if (status->is_known && status->is_dirty) {
+			append_prompt("*", 1);
+		}
+	}
+	bool is_stale = status == NULL || !status->is_known || status->index_mtime != index_stat.st_mtime || status->index_size != index_stat.st_size;
+	char *git_path = is_stale ? find_executable("git") : NULL;
+	if (git_path != NULL && start_git_worker()) {
+		free_git_request(git_request);
+		git_request = (Git_Request *) malloc(sizeof (Git_Request));
+		if (git_request == NULL) {
+			fprintf(stderr, "hush: unable to allocate memory\n");
+			exit(EXIT_FAILURE);
+		}
+		git_request->git_dir = strdup(git_dir);
+		git_request->work_tree = strdup(work_tree);
+		git_request->git_path = strdup(git_path);
+		git_request->environment = copy_environment();
+		git_request->index_mtime = index_stat.st_mtime;
+		git_request->index_size = index_stat.st_size;
+		pthread_cond_signal(&git_requested);
+	}
+	pthread_mutex_unlock(&git_lock);
+}
+
+static void append_cwd(char *cwd)
+{
+	char *home = get_var("HOME", 4);
+	size_t home_len = (home == NULL) ? 0 : strlen(home);
+	if (home_len > 1 && strncmp(cwd, home, home_len) == 0 && (cwd[home_len] == '/' || cwd[home_len] == '\0')) {
+		append_prompt("~", 1);
+		cwd += home_len;
+	}
+	append_prompt(cwd, strlen(cwd));
+}
+
+char *get_prompt(size_t *len)
+{
+	char *format = get_var("PS1", 3);
+	if (format == NULL) {
+		format = DEFAULT_PROMPT;
+	}
+	prompt_len = 0;
+	append_prompt("", 0);
+	char cwd[PATH_MAX];
+	for (char *c = format; *c != '\0'; ++c) {
+		if (*c != '\\' || c[1] == '\0') {
+			append_prompt(c, 1);
+			continue;
+		}
+		char number[32];
+		switch (*++c) {
+			case 'w': {
+				if (getcwd(cwd, sizeof (cwd)) != NULL) {
+					append_cwd(cwd);
+				}
+				break;
+			}
+			case '?': {
+				int number_len = snprintf(number, sizeof (number), "%d", last_status);
+				append_prompt(number, (size_t) number_len);
+				break;
+			}
+			case 'd': {
+				int number_len = snprintf(number, sizeof (number), "%.3fs", last_duration);
+				append_prompt(number, (size_t) number_len);
+				break;
+			}
+			case 'g': {
+				if (getcwd(cwd, sizeof (cwd)) != NULL) {
+					append_git(cwd);
+				}
+				break;
+			}
+			default: {
+				append_prompt(c, 1);
+			}
+		}
+	}
+	*len = prompt_len;
+	return prompt;
+}
@@ -0,0 +1,14 @@
+#ifndef PROMPT_H_
+#define PROMPT_H_
+
+#define DEFAULT_PROMPT "hush % "
+
+// PS1 can use '\w` for the working directory, '\?` for the last status, '\d`
+// for how long the last command took and '\g` for the git branch, followed by
+// '*` if there are uncommitted changes
+char *get_prompt(size_t *len);
+void set_prompt_duration(double duration);
+int get_prompt_fd(void);
+bool take_prompt_update(void);
+
+#endif // PROMPT_H_
@@ -0,0 +1,179 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "buffer.h"
+#include "lexer.h"
+#include "arena.h"
+#include "parser.h"
+#include "builtin.h"
+#include "exec.h"
+#include "fds.h"
+#include "script.h"
+#include "trace.h"
+
+#define QUEUE_CAP 64 // Nodes parsed ahead of the one running
+
+// A node parsed ahead along with anything parsing it reported, which is held
+// back until everything before it has run so messages come out in order.
+// Aliases and functions are only looked up when a command runs, so parsing
+// usually runs ahead freely. The exception is a here-document inside a
+// substitution, whose body is read from the script when the substitution
+// runs, so once one is seen parsing waits for each node to run first.
+typedef struct {
+	Node *node; // NULL if parsing failed
+	Arena arena;
+	FILE *errors;
+	char *error_text;
+	size_t error_len;
+	bool is_end; // The input has run out
+	bool is_failed; // The rest of the line was dropped, which fails it
+} Parsed;
+
+static Parsed queue[QUEUE_CAP];
+static size_t queue_head = 0; // Next to be parsed into
+static size_t queue_tail = 0; // Next to be run
+static bool should_stop = false;
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_changed = PTHREAD_COND_INITIALIZER;
+
+// Waits for room to parse into, NULL once the script is done running
+static Parsed *claim_parsed(void)
+{
+	pthread_mutex_lock(&queue_lock);
+	while (queue_head - queue_tail == QUEUE_CAP && !should_stop) {
+		pthread_cond_wait(&queue_changed, &queue_lock);
+	}
+	Parsed *parsed = should_stop ? NULL : &queue[queue_head % QUEUE_CAP];
+	pthread_mutex_unlock(&queue_lock);
+	return parsed;
+}
+
+static void publish_parsed(void)
+{
+	pthread_mutex_lock(&queue_lock);
+	++queue_head;
+	pthread_cond_broadcast(&queue_changed);
+	pthread_mutex_unlock(&queue_lock);
+}
+
+// Waits for everything parsed so far to have run
+static void wait_for_drain(void)
+{
+	pthread_mutex_lock(&queue_lock);
+	while (queue_head != queue_tail && !should_stop) {
+		pthread_cond_wait(&queue_changed, &queue_lock);
+	}
+	pthread_mutex_unlock(&queue_lock);
+}
+
+static Parsed *take_parsed(void)
+{
+	pthread_mutex_lock(&queue_lock);
+	while (queue_head == queue_tail) {
+		pthread_cond_wait(&queue_changed, &queue_lock);
+	}
+	Parsed *parsed = &queue[queue_tail % QUEUE_CAP];
+	pthread_mutex_unlock(&queue_lock);
+	return parsed;
+}
+
+static void release_parsed(Parsed *parsed)
+{
+	arena_reset(&parsed->arena);
+	pthread_mutex_lock(&queue_lock);
+	++queue_tail;
+	pthread_cond_broadcast(&queue_changed);
+	pthread_mutex_unlock(&queue_lock);
+}
+
+static void *parse_ahead(void *arg)
+{
+	(void) arg;
+	trace_set_thread(2);
+	Buffer *buffer = NULL;
+	bool is_lockstep = false;
+	Parsed *parsed;
+	while ((parsed = claim_parsed()) != NULL) {
+		if (parsed->errors == NULL && (parsed->errors = open_memstream(&parsed->error_text, &parsed->error_len)) == NULL) {
+			fprintf(stderr, "hush: unable to allocate memory\n");
+			exit(EXIT_FAILURE);
+		}
+		rewind(parsed->errors);
+		set_parse_errors(parsed->errors);
+
+		// The script's descriptor may be lent to a redirect in the shell
+		hold_kept_fds();
+		parsed->node = NULL;
+		parsed->is_end = false;
+		if (buffer == NULL) {
+			unsigned long long trace_begin = trace_now();
+			if ((buffer = get_next_buffer()) == NULL) {
+				parsed->is_end = true;
+			} else {
+				trace_record(HUSH_TRACE_INPUT, trace_begin, buffer->text);
+			}
+		}
+
+		// Lines are parsed a node at a time, the same way run_buffer() does
+		parsed->is_failed = false;
+		if (buffer != NULL && (parsed->node = get_next_node(&buffer, &parsed->arena, true, &parsed->is_failed)) == NULL) {
+			buffer = NULL;
+		}
+		release_kept_fds();
+		fflush(parsed->errors);
+		if (parsed->node != NULL || parsed->error_len > 0 || parsed->is_end || parsed->is_failed) {
+			publish_parsed();
+		}
+		if (parsed->is_end) {
+			break;
+		}
+
+		// Once a substitution may read a here-document from the script, which
+		// could happen whenever a function is called, nothing more is read
+		// until what's been parsed has run
+		is_lockstep = take_deferred_input() || is_lockstep;
+		if (is_lockstep) {
+			wait_for_drain();
+		}
+	}
+	return NULL;
+}
+
+int run_script(void)
+{
+	pthread_t parser;
+	if (pthread_create(&parser, NULL, parse_ahead, NULL) != 0) {
+		for (Buffer *buffer = get_next_buffer(); buffer != NULL && !exit_requested; buffer = get_next_buffer()) {
+			run_buffer(buffer);
+		}
+		return last_status;
+	}
+
+	bool is_end = false;
+	while (!is_end && !exit_requested) {
+		Parsed *parsed = take_parsed();
+		if (parsed->error_len > 0) {
+			fwrite(parsed->error_text, sizeof (char), parsed->error_len, stderr);
+		}
+		is_end = parsed->is_end;
+		if (parsed->is_failed) {
+			last_status = 2;
+		}
+		if (parsed->node != NULL) {
+			unsigned long long trace_begin = trace_now();
+			run_nodes(parsed->node);
+			trace_record(HUSH_TRACE_LINE, trace_begin, NULL);
+		}
+		release_parsed(parsed);
+	}
+
+	pthread_mutex_lock(&queue_lock);
+	should_stop = true;
+	pthread_cond_broadcast(&queue_changed);
+	pthread_mutex_unlock(&queue_lock);
+	pthread_join(parser, NULL);
+	return last_status;
+}
@@ -0,0 +1,8 @@
+#ifndef SCRIPT_H_
+#define SCRIPT_H_
+
+// Runs a script read from a file while another thread lexes and parses the
+// commands after the one running
+int run_script(void);
+
+#endif // SCRIPT_H_
@@ -0,0 +1,349 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "fds.h"
+#include "server.h"
+#include "vars.h"
+
+#define NUM_PASSED_FDS 3 // Standard input, output and error
+
+extern char **environ;
+
+// A request is this header followed by the client's working directory,
+// arguments and environment as one run of NUL terminated strings. The
+// client's standard input, output and error are passed along with the header.
+typedef struct {
+	uint32_t len;
+	uint32_t num_args;
+	uint32_t num_vars;
+} Request_Header;
+
+// Each child's exit status is sent back to the client that asked for it
+typedef struct {
+	pid_t pid;
+	int conn_fd;
+} Job;
+
+static Job *jobs = NULL;
+static size_t num_jobs = 0;
+static size_t jobs_cap = 0;
+
+// Written to when a child exits, so waiting for a connection wakes up
+static int child_fds[2] = {-1, -1};
+
+static void note_child(int signum)
+{
+	(void) signum;
+	int saved_errno = errno;
+	write(child_fds[1], "", 1);
+	errno = saved_errno;
+}
+
+static bool write_all(int fd, char *bytes, size_t len)
+{
+	while (len > 0) {
+		ssize_t count = write(fd, bytes, len);
+		if (count == -1 && errno == EINTR) {
+			continue;
+		}
+		if (count <= 0) {
+			return false;
+		}
+		bytes += count;
+		len -= (size_t) count;
+	}
+	return true;
+}
+
+static bool read_all(int fd, char *bytes, size_t len)
+{
+	while (len > 0) {
+		ssize_t count = read(fd, bytes, len);
+		if (count == -1 && errno == EINTR) {
+			continue;
+		}
+		if (count <= 0) {
+			return false;
+		}
+		bytes += count;
+		len -= (size_t) count;
+	}
+	return true;
+}
+
+static bool set_address(struct sockaddr_un *address, char *socket_path)
+{
+	memset(address, 0, sizeof (struct sockaddr_un));
+	address->sun_family = AF_UNIX;
+	if (strlen(socket_path) >= sizeof (address->sun_path)) {
+		return false;
+	}
+	strcpy(address->sun_path, socket_path);
+	return true;
+}
+
+static void append_string(char **payload, size_t *len, size_t *cap, char *string)
+{
+	size_t string_len = strlen(string) + 1;
+	if (*len + string_len > *cap) {
+		while (*len + string_len > *cap) {
+			*cap = (*cap == 0) ? 4096 : 2 * *cap;
+		}
+		*payload = (char *) realloc(*payload, *cap * sizeof (char));
+		if (*payload == NULL) {
+			fprintf(stderr, "hush: unable to allocate memory\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	memcpy(*payload + *len, string, string_len);
+	*len += string_len;
+}
+
+int send_request(char *socket_path, char **args)
+{
+	struct sockaddr_un address;
+	if (!set_address(&address, socket_path)) {
+		return -1;
+	}
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1 || connect(fd, (struct sockaddr *) &address, sizeof (address)) == -1) {
+		if (fd != -1) {
+			close(fd);
+		}
+		return -1;
+	}
+
+	char *payload = NULL, *cwd = getcwd(NULL, 0);
+	size_t len = 0, cap = 0;
+	Request_Header header = {0};
+	append_string(&payload, &len, &cap, (cwd == NULL) ? "/" : cwd);
+	for (; args[header.num_args] != NULL; ++header.num_args) {
+		append_string(&payload, &len, &cap, args[header.num_args]);
+	}
+	for (; environ[header.num_vars] != NULL; ++header.num_vars) {
+		append_string(&payload, &len, &cap, environ[header.num_vars]);
+	}
+	header.len = (uint32_t) len;
+	free(cwd);
+
+	// Closed descriptors can't be passed, the server's children get /dev/null instead
+	int fds[NUM_PASSED_FDS];
+	for (int i = 0; i < NUM_PASSED_FDS; ++i) {
+		fds[i] = (fcntl(i, F_GETFD) == -1) ? open("/dev/null", O_RDWR) : i;
+	}
+	union {
+		char buffer[CMSG_SPACE(sizeof (fds))];
+		struct cmsghdr align;
+	} control;
+	struct iovec header_iov = {.iov_base = &header, .iov_len = sizeof (header)};
+	struct msghdr message = {.msg_iov = &header_iov, .msg_iovlen = 1, .msg_control = control.buffer, .msg_controllen = sizeof (control.buffer)};
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof (fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof (fds));
+	if (sendmsg(fd, &message, 0) != (ssize_t) sizeof (header) || !write_all(fd, payload, len)) {
+		fprintf(stderr, "hush: unable to send the request to '%s`\n", socket_path);
+		free(payload);
+		close(fd);
+		return EXIT_FAILURE;
+	}
+	free(payload);
+
+	int32_t status;
+	if (!read_all(fd, (char *) &status, sizeof (status))) {
+		fprintf(stderr, "hush: lost the connection to '%s`\n", socket_path);
+		status = EXIT_FAILURE;
+	}
+	close(fd);
+	return status;
+}
+
+static void reap_jobs(void)
+{
+	char bytes[64];
+	while (read(child_fds[0], bytes, sizeof (bytes)) > 0);
+
+	int status;
+	pid_t pid;
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		for (size_t i = 0; i < num_jobs; ++i) {
+			if (jobs[i].pid == pid) {
+				int32_t exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+				write_all(jobs[i].conn_fd, (char *) &exit_status, sizeof (exit_status));
+				close_fd(jobs[i].conn_fd);
+				jobs[i] = jobs[--num_jobs];
+				break;
+			}
+		}
+	}
+}
+
+// Splits the payload up into the working directory, arguments and
+// environment, which have to be exactly what the header says
+static bool split_payload(char *payload, Request_Header header, char ***args, char ***vars)
+{
+	if (header.len == 0 || payload[header.len - 1] != '\0') {
+		return false;
+	}
+	size_t num_strings = 0;
+	for (size_t i = 0; i < header.len; ++i) {
+		num_strings += payload[i] == '\0';
+	}
+	if (num_strings != 1 + (size_t) header.num_args + header.num_vars || header.num_args == 0) {
+		return false;
+	}
+	*args = (char **) malloc((header.num_args + 1) * sizeof (char *));
+	*vars = (char **) malloc((header.num_vars + 1) * sizeof (char *));
+	if (*args == NULL || *vars == NULL) {
+		fprintf(stderr, "hush: unable to allocate memory\n");
+		exit(EXIT_FAILURE);
+	}
+	char *string = payload + strlen(payload) + 1;
+	for (size_t i = 0; i < header.num_args; ++i, string += strlen(string) + 1) {
+		(*args)[i] = string;
+	}
+	for (size_t i = 0; i < header.num_vars; ++i, string += strlen(string) + 1) {
+		(*vars)[i] = string;
+	}
+	(*args)[header.num_args] = NULL;
+	(*vars)[header.num_vars] = NULL;
+	return true;
+}
+
+// Forks a child for the request on the connection, returning its arguments
+// in the child and NULL in the server
+static char **take_request(int conn_fd)
+{
+	Request_Header header;
+	int fds[NUM_PASSED_FDS];
+	union {
+		char buffer[CMSG_SPACE(sizeof (fds))];
+		struct cmsghdr align;
+	} control;
+	struct iovec header_iov = {.iov_base = &header, .iov_len = sizeof (header)};
+	struct msghdr message = {.msg_iov = &header_iov, .msg_iovlen = 1, .msg_control = control.buffer, .msg_controllen = sizeof (control.buffer)};
+	ssize_t count = recvmsg(conn_fd, &message, MSG_WAITALL);
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+	if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof (fds))) {
+		close_fd(conn_fd);
+		return NULL;
+	}
+	memcpy(fds, CMSG_DATA(cmsg), sizeof (fds));
+	for (int i = 0; i < NUM_PASSED_FDS; ++i) {
+		track_fd(fds[i]);
+	}
+
+	char *payload = NULL, **args = NULL, **vars = NULL;
+	bool is_valid = count == (ssize_t) sizeof (header) && header.len > 0;
+	if (is_valid) {
+		payload = (char *) malloc(header.len * sizeof (char));
+		is_valid = payload != NULL && read_all(conn_fd, payload, header.len) && split_payload(payload, header, &args, &vars);
+	}
+	pid_t pid = is_valid ? fork() : -1;
+	if (pid == 0) {
+		signal(SIGCHLD, SIG_DFL);
+		signal(SIGPIPE, SIG_DFL);
+
+		// Passed descriptors are moved out of the way first in case one
+		// landed on a standard one. The copies, the socket and every other
+		// job's connection are all the server's own, so they go in one go.
+		for (int i = 0; i < NUM_PASSED_FDS; ++i) {
+			if (fds[i] < NUM_PASSED_FDS) {
+				fds[i] = dup_fd(fds[i], NUM_PASSED_FDS);
+			}
+		}
+		for (int i = 0; i < NUM_PASSED_FDS; ++i) {
+			dup2(fds[i], i);
+		}
+		close_tracked_fds();
+		if (chdir(payload) == -1) {
+			fprintf(stderr, "hush: unable to change directory to '%s`\n", payload);
+			exit(EXIT_FAILURE);
+		}
+		clear_vars();
+		init_vars(vars);
+		environ = vars;
+		return args;
+	}
+
+	for (int i = 0; i < NUM_PASSED_FDS; ++i) {
+		close_fd(fds[i]);
+	}
+	free(payload);
+	free(args);
+	free(vars);
+	if (pid == -1) {
+		close_fd(conn_fd);
+		return NULL;
+	}
+	if (num_jobs == jobs_cap) {
+		jobs_cap = (jobs_cap == 0) ? 16 : 2 * jobs_cap;
+		jobs = (Job *) realloc(jobs, jobs_cap * sizeof (Job));
+		if (jobs == NULL) {
+			fprintf(stderr, "hush: unable to allocate memory\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	jobs[num_jobs++] = (Job) {.pid = pid, .conn_fd = conn_fd};
+	return NULL;
+}
+
+char **serve_requests(char *socket_path)
+{
+	struct sockaddr_un address;
+	if (!set_address(&address, socket_path)) {
+		fprintf(stderr, "hush: socket path '%s` is too long\n", socket_path);
+		return NULL;
+	}
+
+	// A server that's gone leaves its socket behind. Only the user running
+	// the server can connect to the new one.
+	unlink(socket_path);
+	int listen_fd = track_fd(socket(AF_UNIX, SOCK_STREAM, 0));
+	mode_t mask = umask(077);
+	bool is_listening = listen_fd != -1 && bind(listen_fd, (struct sockaddr *) &address, sizeof (address)) == 0 && listen(listen_fd, SOMAXCONN) == 0;
+	umask(mask);
+	if (!is_listening || !open_pipe(child_fds)) {
+		fprintf(stderr, "hush: unable to listen on '%s`\n", socket_path);
+		return NULL;
+	}
+	for (int i = 0; i < 2; ++i) {
+		fcntl(child_fds[i], F_SETFL, fcntl(child_fds[i], F_GETFL) | O_NONBLOCK);
+	}
+	signal(SIGCHLD, note_child);
+	signal(SIGPIPE, SIG_IGN); // Clients may be gone by the time their job is
+
+	while (true) {
+		struct pollfd fds[2] = {{.fd = listen_fd, .events = POLLIN}, {.fd = child_fds[0], .events = POLLIN}};
+		if (poll(fds, 2, -1) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			fprintf(stderr, "hush: unable to wait for requests\n");
+			return NULL;
+		}
+		if (fds[1].revents & POLLIN) {
+			reap_jobs();
+		}
+		if (fds[0].revents & POLLIN) {
+			int conn_fd = track_fd(accept(listen_fd, NULL, NULL));
+			char **args = (conn_fd == -1) ? NULL : take_request(conn_fd);
+			if (args != NULL) {
+				return args;
+			}
+		}
+	}
+}
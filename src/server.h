@@ -0,0 +1,14 @@
+#ifndef SERVER_H_
+#define SERVER_H_
+
+// A server stays running so every script it's asked to run starts from a
+// fork of an already set up shell instead of a new process. It only returns
+// in the children, with the arguments the client was given, so they go on
+// as if hush had been started with them.
+char **serve_requests(char *socket_path);
+
+// Returns the exit status of what the server ran, or -1 if there's no
+// server to run it
+int send_request(char *socket_path, char **args);
+
+#endif // SERVER_H_
@@ -0,0 +1,137 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "suggest.h"
+
+#define EDGES_INITIAL_CAP 1024 // Has to be a power of two
+
+typedef struct {
+	unsigned long newest; // Zero when nothing's been indexed through here
+	size_t slot;
+} Prefix_Node;
+
+// Each node's children are found by looking up the node and the next byte,
+// so following a prefix takes one probe a byte however many children there are
+typedef struct {
+	size_t parent;
+	size_t child; // Zero for an empty edge, the root is never a child
+	unsigned char byte;
+} Prefix_Edge;
+
+static Prefix_Node *nodes = NULL;
+static size_t num_nodes = 0;
+static size_t nodes_cap = 0;
+static Prefix_Edge *edges = NULL;
+static size_t num_edges = 0;
+static size_t edges_cap = 0;
+
+static void *allocate(void *pointer, size_t size)
+{
+	pointer = realloc(pointer, size);
+	if (pointer == NULL) {
+		fprintf(stderr, "hush: unable to allocate memory\n");
+		exit(EXIT_FAILURE);
+	}
+	return pointer;
+}
+
+static Prefix_Edge *find_edge(Prefix_Edge *in, size_t cap, size_t parent, unsigned char byte)
+{
+	size_t hash = (parent * 257 + byte) * (size_t) 11400714819323198485ULL;
+	for (size_t i = (hash >> 16) & (cap - 1);; i = (i + 1) & (cap - 1)) {
+		if (in[i].child == 0 || (in[i].parent == parent && in[i].byte == byte)) {
+			return &in[i];
+		}
+	}
+}
+
+static void grow_edges(void)
+{
+	size_t cap = (edges_cap == 0) ? EDGES_INITIAL_CAP : 2 * edges_cap;
+	Prefix_Edge *grown = (Prefix_Edge *) calloc(cap, sizeof (Prefix_Edge));
+	if (grown == NULL) {
+		fprintf(stderr, "hush: unable to allocate memory\n");
+		exit(EXIT_FAILURE);
+	}
+	for (size_t i = 0; i < edges_cap; ++i) {
+		if (edges[i].child != 0) {
+			*find_edge(grown, cap, edges[i].parent, edges[i].byte) = edges[i];
+		}
+	}
+	free(edges);
+	edges = grown;
+	edges_cap = cap;
+}
+
+void clear_entry_index(void)
+{
+	if (edges != NULL) {
+		memset(edges, 0, edges_cap * sizeof (Prefix_Edge));
+	}
+	num_edges = 0;
+	num_nodes = 1;
+	if (nodes_cap == 0) {
+		nodes_cap = EDGES_INITIAL_CAP;
+		nodes = (Prefix_Node *) allocate(nodes, nodes_cap * sizeof (Prefix_Node));
+	}
+	nodes[PREFIX_ROOT] = (Prefix_Node) {0};
+}
+
+void index_entry(char *text, size_t len, unsigned long id, size_t slot)
+{
+	if (num_nodes == 0) {
+		clear_entry_index();
+	}
+	size_t node = PREFIX_ROOT;
+	for (size_t i = 0; i <= len; ++i) {
+		nodes[node].newest = id;
+		nodes[node].slot = slot;
+		if (i == len) {
+			break;
+		}
+
+		// Keep the load factor under 1/2
+		if (2 * (num_edges + 1) > edges_cap) {
+			grow_edges();
+		}
+		Prefix_Edge *edge = find_edge(edges, edges_cap, node, (unsigned char) text[i]);
+		if (edge->child == 0) {
+			if (num_nodes == nodes_cap) {
+				nodes_cap *= 2;
+				nodes = (Prefix_Node *) allocate(nodes, nodes_cap * sizeof (Prefix_Node));
+			}
+			nodes[num_nodes] = (Prefix_Node) {0};
+			*edge = (Prefix_Edge) {.parent = node, .child = num_nodes++, .byte = (unsigned char) text[i]};
+			++num_edges;
+		}
+		node = edge->child;
+	}
+}
+
+size_t get_index_size(void)
+{
+	return num_nodes;
+}
+
+size_t follow_prefix(size_t node, char *bytes, size_t len)
+{
+	if (num_edges == 0) {
+		return NO_PREFIX;
+	}
+	for (size_t i = 0; i < len && node != NO_PREFIX; ++i) {
+		Prefix_Edge *edge = find_edge(edges, edges_cap, node, (unsigned char) bytes[i]);
+		node = (edge->child == 0) ? NO_PREFIX : edge->child;
+	}
+	return node;
+}
+
+unsigned long get_newest_entry(size_t node, size_t *slot)
+{
+	if (node == NO_PREFIX || num_nodes == 0) {
+		return 0;
+	}
+	*slot = nodes[node].slot;
+	return nodes[node].newest;
+}
@@ -0,0 +1,16 @@
+#ifndef SUGGEST_H_
+#define SUGGEST_H_
+
+#define PREFIX_ROOT 0
+#define NO_PREFIX ((size_t) -1)
+
+// A trie over the history entries that remembers, for every prefix, the
+// newest entry starting with it. Entries are given ids that only go up, so
+// the newest is just the largest, and the slot they were stored in.
+void clear_entry_index(void);
+void index_entry(char *text, size_t len, unsigned long id, size_t slot);
+size_t get_index_size(void);
+size_t follow_prefix(size_t node, char *bytes, size_t len);
+unsigned long get_newest_entry(size_t node, size_t *slot);
+
+#endif // SUGGEST_H_
@@ -0,0 +1,82 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "table.h"
+
+#define TABLE_INITIAL_CAP 64
+
+static size_t hash_key(char *key, size_t key_len)
+{
+	// FNV-1a
+	size_t hash = (size_t) 14695981039346656037ULL;
+	for (size_t i = 0; i < key_len; ++i) {
+		hash ^= (unsigned char) key[i];
+		hash *= (size_t) 1099511628211ULL;
+	}
+	return hash;
+}
+
+static Table_Entry *find_slot(Table_Entry *entries, size_t cap, char *key, size_t key_len, size_t hash)
+{
+	for (size_t i = hash & (cap - 1);; i = (i + 1) & (cap - 1)) {
+		Table_Entry *entry = &entries[i];
+		if (entry->key == NULL) {
+			return entry;
+		}
+		if (entry->hash == hash && entry->key_len == key_len && memcmp(entry->key, key, key_len) == 0) {
+			return entry;
+		}
+	}
+}
+
+Table_Entry *table_find(Table *table, char *key, size_t key_len)
+{
+	if (table->cap == 0) {
+		return NULL;
+	}
+	Table_Entry *entry = find_slot(table->entries, table->cap, key, key_len, hash_key(key, key_len));
+	return (entry->key == NULL) ? NULL : entry;
+}
+
+static void grow_table(Table *table)
+{
+	size_t cap = (table->cap == 0) ? TABLE_INITIAL_CAP : 2 * table->cap;
+	Table_Entry *entries = (Table_Entry *) calloc(cap, sizeof (Table_Entry));
+	if (entries == NULL) {
+		fprintf(stderr, "hush: unable to allocate memory\n");
+		exit(EXIT_FAILURE);
+	}
+	for (size_t i = 0; i < table->cap; ++i) {
+		Table_Entry *entry = &table->entries[i];
+		if (entry->key != NULL) {
+			*find_slot(entries, cap, entry->key, entry->key_len, entry->hash) = *entry;
+		}
+	}
+	free(table->entries);
+	table->entries = entries;
+	table->cap = cap;
+}
+
+Table_Entry *table_insert(Table *table, char *key, size_t key_len)
+{
+	// Keep the load factor under 3/4
+	if (4 * (table->count + 1) > 3 * table->cap) {
+		grow_table(table);
+	}
+	size_t hash = hash_key(key, key_len);
+	Table_Entry *entry = find_slot(table->entries, table->cap, key, key_len, hash);
+	if (entry->key == NULL) {
+		entry->key = strndup(key, key_len);
+		if (entry->key == NULL) {
+			fprintf(stderr, "hush: unable to allocate memory\n");
+			exit(EXIT_FAILURE);
+		}
+		entry->key_len = key_len;
+		entry->hash = hash;
+		entry->value = NULL;
+		++table->count;
+	}
+	return entry;
+}
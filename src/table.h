@@ -0,0 +1,22 @@
+#ifndef TABLE_H_
+#define TABLE_H_
+
+typedef struct {
+	char *key; // Interned, lives as long as the table
+	size_t key_len;
+	size_t hash;
+	void *value;
+} Table_Entry;
+
+// Open addressing hash table with linear probing. Entries are never removed,
+// a key that's no longer needed just has its value set to NULL.
+typedef struct {
+	Table_Entry *entries;
+	size_t count;
+	size_t cap;
+} Table;
+
+Table_Entry *table_find(Table *table, char *key, size_t key_len);
+Table_Entry *table_insert(Table *table, char *key, size_t key_len);
+
+#endif // TABLE_H_
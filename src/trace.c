@@ -0,0 +1,255 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fds.h"
+#include "trace.h"
+
+#define TRACE_RING_CAP 4096 // Has to be a power of two
+#define TRACE_DETAIL_CAP 48
+#define TRACE_FLUSH_NS 50000000L
+#define STARTUP_PHASE_CAP 16
+
+typedef struct {
+	atomic_size_t sequence; // One past the claim that filled it, once it has been
+	unsigned long long begin;
+	unsigned long long end;
+	Hush_Trace_Event event;
+	int tid;
+	char detail[TRACE_DETAIL_CAP];
+} Trace_Record;
+
+#define TRACE_EVENT_NAME(event, name) name,
+static char *event_names[] = {
+	FOR_TRACE_EVENTS(TRACE_EVENT_NAME)
+};
+#undef TRACE_EVENT_NAME
+
+// Read by the parser and history threads while 'set -o trace` changes it
+static atomic_bool is_tracing = false;
+
+// Writers claim slots at the head and the flushing thread reads at the tail,
+// so neither has to wait on the other. Scripts are parsed on a thread of
+// their own, so a slot is only read once its writer has marked it filled.
+// Records that come in while the ring is full are dropped and counted.
+static Trace_Record ring[TRACE_RING_CAP];
+static atomic_size_t ring_head = 0;
+static atomic_size_t ring_tail = 0;
+static atomic_size_t num_dropped = 0;
+static _Thread_local int thread_id = 1;
+
+static FILE *trace_file = NULL;
+static pthread_t flusher;
+static atomic_bool should_stop = false;
+static pid_t trace_pid;
+
+static unsigned long long get_time_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (unsigned long long) now.tv_sec * 1000000000ULL + (unsigned long long) now.tv_nsec;
+}
+
+bool trace_is_on(void)
+{
+	return atomic_load_explicit(&is_tracing, memory_order_relaxed);
+}
+
+unsigned long long trace_now(void)
+{
+	return trace_is_on() ? get_time_ns() : 0;
+}
+
+void trace_record(Hush_Trace_Event event, unsigned long long begin, char *detail)
+{
+	if (!trace_is_on()) {
+		return;
+	}
+	size_t head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+	do {
+		if (head - atomic_load_explicit(&ring_tail, memory_order_acquire) >= TRACE_RING_CAP) {
+			atomic_fetch_add_explicit(&num_dropped, 1, memory_order_relaxed);
+			return;
+		}
+	} while (!atomic_compare_exchange_weak_explicit(&ring_head, &head, head + 1, memory_order_relaxed, memory_order_relaxed));
+	Trace_Record *record = &ring[head & (TRACE_RING_CAP - 1)];
+	record->event = event;
+	record->tid = thread_id;
+	record->begin = begin;
+	record->end = get_time_ns();
+	record->detail[0] = '\0';
+	if (detail != NULL) {
+		strncpy(record->detail, detail, TRACE_DETAIL_CAP - 1);
+		record->detail[TRACE_DETAIL_CAP - 1] = '\0';
+	}
+	atomic_store_explicit(&record->sequence, head + 1, memory_order_release);
+}
+
+void trace_set_thread(int tid)
+{
+	thread_id = tid;
+}
+
+typedef struct {
+	char *name;
+	unsigned long long duration;
+} Startup_Phase;
+
+bool is_profiling_startup = false;
+static unsigned long long startup_begin;
+static Startup_Phase startup_phases[STARTUP_PHASE_CAP];
+static size_t num_startup_phases = 0;
+static pthread_mutex_t phase_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void start_startup_profile(void)
+{
+	is_profiling_startup = true;
+	startup_begin = get_time_ns();
+}
+
+unsigned long long profile_now(void)
+{
+	return is_profiling_startup ? get_time_ns() : 0;
+}
+
+// History is read on its own thread, so phases can end on either
+void profile_phase(char *name, unsigned long long begin)
+{
+	if (!is_profiling_startup) {
+		return;
+	}
+	unsigned long long end = get_time_ns();
+	pthread_mutex_lock(&phase_lock);
+	if (num_startup_phases < STARTUP_PHASE_CAP) {
+		startup_phases[num_startup_phases++] = (Startup_Phase) {name, end - ((begin == 0) ? startup_begin : begin)};
+	}
+	pthread_mutex_unlock(&phase_lock);
+}
+
+void report_startup_profile(void)
+{
+	if (!is_profiling_startup) {
+		return;
+	}
+	pthread_mutex_lock(&phase_lock);
+	for (size_t i = 0; i < num_startup_phases; ++i) {
+		fprintf(stderr, "hush: startup: %-14s %10.1f us\n", startup_phases[i].name, startup_phases[i].duration / 1000.0);
+	}
+	pthread_mutex_unlock(&phase_lock);
+}
+
+static void write_json_string(char *string)
+{
+	fputc('"', trace_file);
+	for (; *string != '\0'; ++string) {
+		if (*string == '"' || *string == '\\') {
+			fprintf(trace_file, "\\%c", *string);
+		} else if ((unsigned char) *string < ' ') {
+			fprintf(trace_file, "\\u%04x", (unsigned char) *string);
+		} else {
+			fputc(*string, trace_file);
+		}
+	}
+	fputc('"', trace_file);
+}
+
+// Writes out everything in the ring as complete events in Chrome's trace
+// format, which chrome://tracing and Perfetto both load. A slot still being
+// filled holds up the ones after it until the next flush.
+static void flush_ring(void)
+{
+	size_t tail = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+	for (;; ++tail) {
+		Trace_Record *record = &ring[tail & (TRACE_RING_CAP - 1)];
+		if (atomic_load_explicit(&record->sequence, memory_order_acquire) != tail + 1) {
+			break;
+		}
+		fprintf(trace_file, "{\"name\":\"%s\",\"cat\":\"hush\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"detail\":",
+			event_names[record->event], (int) trace_pid, record->tid, record->begin / 1000.0, (record->end - record->begin) / 1000.0);
+		write_json_string(record->detail);
+		fprintf(trace_file, "}},\n");
+		atomic_store_explicit(&ring_tail, tail + 1, memory_order_release);
+	}
+	fflush(trace_file);
+}
+
+static void *run_flusher(void *arg)
+{
+	(void) arg;
+	struct timespec interval = {0, TRACE_FLUSH_NS};
+	while (!atomic_load(&should_stop)) {
+
+		// The trace file's descriptor may be lent to a redirect in the shell,
+		// in which case the ring is written out next time
+		if (try_hold_kept_fds()) {
+			flush_ring();
+			release_kept_fds();
+		}
+		nanosleep(&interval, NULL);
+	}
+	if (try_hold_kept_fds()) {
+		flush_ring();
+		release_kept_fds();
+	}
+	return NULL;
+}
+
+// Forked children get a copy of the ring but not the thread that flushes it
+static void stop_in_child(void)
+{
+	atomic_store(&is_tracing, false);
+}
+
+bool trace_start(char *path)
+{
+	static bool is_fork_handled = false;
+	if (trace_is_on()) {
+		return true;
+	}
+	int trace_fd = keep_fd(open_fd(path, O_WRONLY | O_CREAT | O_TRUNC, 0666));
+	trace_file = (trace_fd == -1) ? NULL : fdopen(trace_fd, "w");
+	if (trace_file == NULL) {
+		fprintf(stderr, "hush: unable to open trace file '%s`\n", path);
+		return false;
+	}
+
+	// The closing bracket is optional in the array format, so a trace cut
+	// short by a crash still loads
+	fprintf(trace_file, "[\n");
+	trace_pid = getpid();
+	atomic_store(&num_dropped, 0);
+	atomic_store(&should_stop, false);
+	if (pthread_create(&flusher, NULL, run_flusher, NULL) != 0) {
+		fprintf(stderr, "hush: unable to start tracing\n");
+		untrack_fd(fileno(trace_file));
+		fclose(trace_file);
+		return false;
+	}
+	if (!is_fork_handled) {
+		pthread_atfork(NULL, NULL, stop_in_child);
+		is_fork_handled = true;
+	}
+	atomic_store(&is_tracing, true);
+	return true;
+}
+
+void trace_stop(void)
+{
+	if (!trace_is_on()) {
+		return;
+	}
+	unsigned long long end = trace_now();
+	atomic_store(&is_tracing, false);
+	atomic_store(&should_stop, true);
+	pthread_join(flusher, NULL);
+	fprintf(trace_file, "{\"name\":\"dropped\",\"cat\":\"hush\",\"ph\":\"i\",\"s\":\"g\",\"pid\":%d,\"tid\":1,\"ts\":%.3f,\"args\":{\"count\":%zu}}\n]\n",
+		(int) trace_pid, end / 1000.0, atomic_load(&num_dropped));
+	untrack_fd(fileno(trace_file));
+	fclose(trace_file);
+	trace_file = NULL;
+}
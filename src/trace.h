@@ -0,0 +1,36 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#define FOR_TRACE_EVENTS(DO) \
+	DO(LINE, "line") \
+	DO(INPUT, "input") \
+	DO(PARSE, "parse") \
+	DO(LEX, "lex") \
+	DO(RESOLVE, "resolve") \
+	DO(SPAWN, "spawn") \
+	DO(WAIT, "wait") \
+
+#define TRACE_EVENT_ENUM(event, name) HUSH_TRACE_##event,
+typedef enum {
+	FOR_TRACE_EVENTS(TRACE_EVENT_ENUM)
+} Hush_Trace_Event;
+#undef TRACE_EVENT_ENUM
+
+// Spans are recorded by taking trace_now() before the work and passing it to
+// trace_record() after, both do nothing unless tracing is on
+bool trace_is_on(void);
+unsigned long long trace_now(void);
+void trace_record(Hush_Trace_Event event, unsigned long long begin, char *detail);
+void trace_set_thread(int tid);
+
+// Startup is timed phase by phase with --startup-profile, and reported once
+// hush is done. A phase begun at zero is timed from when profiling started.
+extern bool is_profiling_startup;
+void start_startup_profile(void);
+unsigned long long profile_now(void);
+void profile_phase(char *name, unsigned long long begin);
+void report_startup_profile(void);
+bool trace_start(char *path);
+void trace_stop(void);
+
+#endif // TRACE_H_
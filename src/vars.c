@@ -0,0 +1,172 @@
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "table.h"
+#include "vars.h"
+
+typedef struct {
+	char *entry; // "NAME=value", so it can go straight into the environment
+	char *value;
+	bool is_exported;
+} Var;
+
+unsigned long path_version = 0;
+unsigned long cdpath_version = 0;
+
+static Table vars;
+
+// The environment handed to exec is only rebuilt when an exported variable
+// changed since the last time it was asked for
+static char **environment = NULL;
+static size_t environment_cap = 0;
+static bool is_environment_dirty = true;
+
+static void note_change(Table_Entry *entry, Var *var)
+{
+	if (var->is_exported) {
+		is_environment_dirty = true;
+	}
+	if (entry->key_len == 4 && memcmp(entry->key, "PATH", 4) == 0) {
+		++path_version;
+	} else if (entry->key_len == 6 && memcmp(entry->key, "CDPATH", 6) == 0) {
+		++cdpath_version;
+	}
+}
+
+static Var *get_var_struct(Table_Entry *entry)
+{
+	if (entry->value == NULL) {
+		entry->value = calloc(1, sizeof (Var));
+		if (entry->value == NULL) {
+			fprintf(stderr, "hush: unable to allocate memory\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	return (Var *) entry->value;
+}
+
+void init_vars(char **envp)
+{
+	for (; *envp != NULL; ++envp) {
+		char *equals = strchr(*envp, '=');
+		if (equals == NULL) {
+			continue;
+		}
+		set_var(*envp, equals - *envp, equals + 1);
+		export_var(*envp, equals - *envp);
+	}
+}
+
+char *get_var(char *name, size_t name_len)
+{
+	Table_Entry *entry = table_find(&vars, name, name_len);
+	if (entry == NULL || entry->value == NULL) {
+		return NULL;
+	}
+	return ((Var *) entry->value)->value;
+}
+
+void set_var(char *name, size_t name_len, char *value)
+{
+	Table_Entry *entry = table_insert(&vars, name, name_len);
+	Var *var = get_var_struct(entry);
+	size_t value_len = strlen(value);
+	free(var->entry);
+	var->entry = (char *) malloc((name_len + value_len + 2) * sizeof (char));
+	if (var->entry == NULL) {
+		fprintf(stderr, "hush: unable to allocate memory\n");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(var->entry, entry->key, name_len);
+	var->entry[name_len] = '=';
+	var->value = var->entry + name_len + 1;
+	memcpy(var->value, value, value_len + 1);
+	note_change(entry, var);
+}
+
+void export_var(char *name, size_t name_len)
+{
+	Table_Entry *entry = table_insert(&vars, name, name_len);
+	Var *var = get_var_struct(entry);
+	if (!var->is_exported) {
+		var->is_exported = true;
+		is_environment_dirty = var->entry != NULL || is_environment_dirty;
+	}
+}
+
+void unset_var(char *name, size_t name_len)
+{
+	Table_Entry *entry = table_find(&vars, name, name_len);
+	if (entry == NULL || entry->value == NULL) {
+		return;
+	}
+	Var *var = (Var *) entry->value;
+	note_change(entry, var);
+	free(var->entry);
+	free(var);
+	entry->value = NULL;
+}
+
+// Forgets every variable, e.g. before taking on another process's environment
+void clear_vars(void)
+{
+	for (size_t i = 0; i < vars.cap; ++i) {
+		if (vars.entries[i].value != NULL) {
+			unset_var(vars.entries[i].key, vars.entries[i].key_len);
+		}
+	}
+}
+
+// Returns the length of NAME if the word looks like 'NAME=value`, 0 otherwise
+size_t get_assignment_name_len(char *word)
+{
+	if (!isalpha(*word) && *word != '_') {
+		return 0;
+	}
+	size_t name_len = 1;
+	for (; isalnum(word[name_len]) || word[name_len] == '_'; ++name_len);
+	return (word[name_len] == '=') ? name_len : 0;
+}
+
+char **get_environment(void)
+{
+	if (!is_environment_dirty) {
+		return environment;
+	}
+
+	size_t count = 0;
+	for (size_t i = 0; i < vars.cap; ++i) {
+		Var *var = (Var *) vars.entries[i].value;
+		count += var != NULL && var->is_exported && var->entry != NULL;
+	}
+	if (count + 1 > environment_cap) {
+		environment_cap = 2 * (count + 1);
+		free(environment);
+		environment = (char **) malloc(environment_cap * sizeof (char *));
+		if (environment == NULL) {
+			fprintf(stderr, "hush: unable to allocate memory\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	count = 0;
+	for (size_t i = 0; i < vars.cap; ++i) {
+		Var *var = (Var *) vars.entries[i].value;
+		if (var != NULL && var->is_exported && var->entry != NULL) {
+			environment[count++] = var->entry;
+		}
+	}
+	environment[count] = NULL;
+	is_environment_dirty = false;
+	return environment;
+}
+
+void print_exported_vars(void)
+{
+	char **envp = get_environment();
+	for (; *envp != NULL; ++envp) {
+		printf("export %s\n", *envp);
+	}
+}
@@ -0,0 +1,17 @@
+#ifndef VARS_H_
+#define VARS_H_
+
+extern unsigned long path_version; // Bumped whenever PATH changes
+extern unsigned long cdpath_version; // Bumped whenever CDPATH changes
+
+void init_vars(char **envp);
+char *get_var(char *name, size_t name_len);
+void set_var(char *name, size_t name_len, char *value);
+void export_var(char *name, size_t name_len);
+void unset_var(char *name, size_t name_len);
+void clear_vars(void);
+size_t get_assignment_name_len(char *word);
+char **get_environment(void);
+void print_exported_vars(void);
+
+#endif // VARS_H_